@@ -0,0 +1,263 @@
+/*
+ * Microbenchmarks of the de2i-150 driver interface, for the access patterns
+ * of the game: select + write and select + read pairs of the legacy
+ * commands, the value-carrying ioctls, direct MMIO and whole output frames.
+ *
+ *	fpga_bench [-d device] [-n iterations] [-b]
+ *
+ * Runs against /dev/de2i-150 by default, or any compatible node (e.g. the
+ * emulator or another board). -b opens the device O_NONBLOCK like the game
+ * does, so writes are posted. Results go to stdout as one JSON object per
+ * benchmark; progress and errors go to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "ioctl_cmds.h"
+#include "fpga_mmio.h"
+
+static int fd;
+static volatile uint32_t* regs;
+static uint32_t sink;
+
+/* one operation of a benchmark, returns < 0 with errno set on failure */
+typedef int (*bench_op)(uint32_t i);
+
+/* output registers of a frame, as written by the game every tick */
+static const unsigned int frame_sel[4] = {
+	WR_RED_LEDS, WR_GREEN_LEDS, WR_L_DISPLAY, WR_R_DISPLAY
+};
+static const unsigned int frame_periph[4] = {
+	PERIPH_RED_LEDS, PERIPH_GREEN_LEDS, PERIPH_L_DISPLAY, PERIPH_R_DISPLAY
+};
+
+static int select_write(uint32_t i)
+{
+	if (ioctl(fd, WR_RED_LEDS) < 0)
+		return -1;
+	return write(fd, &i, sizeof(i)) == sizeof(i) ? 0 : -1;
+}
+
+static int select_read(uint32_t i)
+{
+	if (ioctl(fd, RD_SWITCHES) < 0)
+		return -1;
+	return read(fd, &sink, sizeof(sink)) == sizeof(sink) ? 0 : -1;
+}
+
+static int wr_reg(uint32_t i)
+{
+	struct ihs_reg reg = { PERIPH_RED_LEDS, i };
+	return ioctl(fd, WR_REG, &reg);
+}
+
+static int rd_reg(uint32_t i)
+{
+	struct ihs_reg reg = { PERIPH_SWITCHES, 0 };
+	int ret = ioctl(fd, RD_REG, &reg);
+	sink = reg.value;
+	return ret;
+}
+
+static int rd_inputs(uint32_t i)
+{
+	struct ihs_inputs in;
+	int ret = ioctl(fd, RD_INPUTS, &in);
+	sink = in.switches ^ in.buttons;
+	return ret;
+}
+
+static int mmio_write(uint32_t i)
+{
+	FPGA_MMIO_REG(regs, LEDR) = i;
+	return 0;
+}
+
+static int mmio_read(uint32_t i)
+{
+	sink = FPGA_MMIO_REG(regs, INPORT);
+	return 0;
+}
+
+static int frame_select_write(uint32_t i)
+{
+	for (int r = 0; r < 4; r++) {
+		if (ioctl(fd, frame_sel[r]) < 0)
+			return -1;
+		if (write(fd, &i, sizeof(i)) != sizeof(i))
+			return -1;
+	}
+	return 0;
+}
+
+static int frame_wr_reg(uint32_t i)
+{
+	for (int r = 0; r < 4; r++) {
+		struct ihs_reg reg = { frame_periph[r], i };
+		if (ioctl(fd, WR_REG, &reg) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* a frame that waits for the board, like cleanup_hardware() */
+static int frame_wr_reg_sync(uint32_t i)
+{
+	if (frame_wr_reg(i) < 0)
+		return -1;
+	return ioctl(fd, WR_SYNC);
+}
+
+/* same registers as frame_periph, each store at a fixed offset */
+static int frame_mmio(uint32_t i)
+{
+	FPGA_MMIO_REG(regs, LEDR) = i;
+	FPGA_MMIO_REG(regs, LEDG) = i;
+	FPGA_MMIO_REG(regs, HEXPORT1) = i;
+	FPGA_MMIO_REG(regs, HEXPORT) = i;
+	return 0;
+}
+
+static const struct {
+	const char* name;
+	bench_op op;
+	int needs_mmio;
+} benches[] = {
+	{ "select_write",       select_write,       0 },
+	{ "select_read",        select_read,        0 },
+	{ "wr_reg",             wr_reg,             0 },
+	{ "rd_reg",             rd_reg,             0 },
+	{ "rd_inputs",          rd_inputs,          0 },
+	{ "mmio_write",         mmio_write,         1 },
+	{ "mmio_read",          mmio_read,          1 },
+	{ "frame_select_write", frame_select_write, 0 },
+	{ "frame_wr_reg",       frame_wr_reg,       0 },
+	{ "frame_wr_reg_sync",  frame_wr_reg_sync,  0 },
+	{ "frame_mmio",         frame_mmio,         1 },
+};
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ll(const void* a, const void* b)
+{
+	long long x = *(const long long*)a, y = *(const long long*)b;
+	return (x > y) - (x < y);
+}
+
+/* nearest-rank percentile of sorted samples */
+static long long pct(const long long* s, long n, double q)
+{
+	long rank = (long)(q * (n - 1) + 0.5);
+	return s[rank];
+}
+
+static void run(const char* name, bench_op op, long n, long long* lat)
+{
+	long warmup = n / 10 + 1;
+	double sum = 0;
+
+	/* first call tells whether the device supports it at all */
+	if (op(0) < 0) {
+		printf("{\"bench\":\"%s\",\"skipped\":\"%s\"}\n", name, strerror(errno));
+		fprintf(stderr, "%-20s skipped: %s\n", name, strerror(errno));
+		return;
+	}
+	for (long i = 0; i < warmup; i++)
+		op((uint32_t)i);
+
+	long long start = now_ns();
+	for (long i = 0; i < n; i++) {
+		long long t = now_ns();
+		if (op((uint32_t)i) < 0) {
+			printf("{\"bench\":\"%s\",\"failed\":\"%s\",\"after\":%ld}\n",
+			       name, strerror(errno), i);
+			fprintf(stderr, "%-20s failed after %ld ops: %s\n", name, i, strerror(errno));
+			return;
+		}
+		lat[i] = now_ns() - t;
+	}
+	long long elapsed = now_ns() - start;
+
+	for (long i = 0; i < n; i++)
+		sum += lat[i];
+	qsort(lat, n, sizeof(lat[0]), cmp_ll);
+
+	printf("{\"bench\":\"%s\",\"ops\":%ld,\"ops_per_s\":%.0f,\"mean_ns\":%.1f,"
+	       "\"min_ns\":%lld,\"p50_ns\":%lld,\"p90_ns\":%lld,\"p99_ns\":%lld,"
+	       "\"p999_ns\":%lld,\"max_ns\":%lld}\n",
+	       name, n, n * 1e9 / elapsed, sum / n, lat[0], pct(lat, n, 0.50),
+	       pct(lat, n, 0.90), pct(lat, n, 0.99), pct(lat, n, 0.999), lat[n - 1]);
+	fflush(stdout);
+	fprintf(stderr, "%-20s %10.0f ops/s  p50 %6lld ns  p99 %7lld ns\n",
+		name, n * 1e9 / elapsed, pct(lat, n, 0.50), pct(lat, n, 0.99));
+}
+
+int main(int argc, char** argv)
+{
+	const char* dev = "/dev/de2i-150";
+	long n = 100000;
+	int flags = O_RDWR;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:n:b")) != -1) {
+		switch (opt) {
+		case 'd': dev = optarg; break;
+		case 'n': n = atol(optarg); break;
+		case 'b': flags |= O_NONBLOCK; break;
+		default:
+			fprintf(stderr, "Syntax: %s [-d device] [-n iterations] [-b]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (n < 1) {
+		fprintf(stderr, "iterations must be positive\n");
+		return 1;
+	}
+
+	if ((fd = open(dev, flags)) < 0) {
+		fprintf(stderr, "%s: %s\n", dev, strerror(errno));
+		return 1;
+	}
+	regs = fpga_mmio_map(fd);
+
+	long long* lat = malloc(n * sizeof(*lat));
+	if (!lat) {
+		fprintf(stderr, "no memory for %ld samples\n", n);
+		return 1;
+	}
+
+	printf("{\"device\":\"%s\",\"nonblock\":%s,\"mmio\":%s,\"iterations\":%ld}\n",
+	       dev, (flags & O_NONBLOCK) ? "true" : "false", regs ? "true" : "false", n);
+
+	for (unsigned int b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+		if (benches[b].needs_mmio && !regs) {
+			printf("{\"bench\":\"%s\",\"skipped\":\"not mapped\"}\n", benches[b].name);
+			continue;
+		}
+		run(benches[b].name, benches[b].op, n, lat);
+	}
+
+	/* leave the outputs dark, display segments are active low */
+	for (int r = 0; r < 4; r++) {
+		struct ihs_reg reg = { frame_periph[r], r < 2 ? 0 : 0xFFFFFFFF };
+		ioctl(fd, WR_REG, &reg);
+	}
+	if (regs)
+		fpga_mmio_unmap(regs);
+	free(lat);
+	close(fd);
+	return 0;
+}
@@ -8,7 +8,7 @@ cat > test_driver.c << 'EOF'
 #include <errno.h>
 #include <string.h>
 
-#define WR_RED_LEDS   _IO('a', 'e')
+#include "include/ioctl_cmds.h"
 
 int main() {
     printf("=== DIAGNÓSTICO DRIVER ===\n");
@@ -0,0 +1,795 @@
+#include <linux/init.h>
+#include <linux/device.h>
+#include <linux/module.h>	/* THIS_MODULE macro */
+#include <linux/fs.h>		/* VFS related */
+#include <linux/ioctl.h>	/* ioctl syscall */
+#include <linux/errno.h>	/* error codes */
+#include <linux/types.h>	/* dev_t number */
+#include <linux/cdev.h>		/* char device registration */
+#include <linux/uaccess.h>	/* copy_*_user functions */
+#include <linux/mm.h>		/* mmap related */
+#include <linux/gfp.h>		/* register page */
+#include <linux/slab.h>		/* kzalloc/kfree */
+#include <linux/spinlock.h>	/* register serialization */
+#include <linux/mutex.h>	/* event reads */
+#include <linux/delay.h>	/* emulated bus latency */
+#include <linux/ktime.h>	/* event timestamps */
+#include <linux/wait.h>		/* wait queues */
+#include <linux/poll.h>		/* poll syscall */
+#include <linux/workqueue.h>	/* animation player */
+
+#include "../../include/ioctl_cmds.h"
+
+/*
+ * Software stand-in for the DE2i-150 PCI driver (driver/pci/de2i-150.c): the
+ * same /dev/de2i-150 node, ioctl commands and BAR0 register layout, backed by
+ * a page of RAM instead of the FPGA. Inputs are set from user space through
+ * sysfs, outputs can be read back there, so the game runs on any Linux box:
+ *
+ *	$ echo 0x3 | sudo tee /sys/class/MyModuleClass/de2i-150/switches
+ *	$ cat /sys/class/MyModuleClass/de2i-150/hex_r
+ *
+ * Only load it on machines without the board, both drivers create the same node.
+ */
+
+/* meta information */
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("mfbsouza");
+MODULE_DESCRIPTION("software emulator of the DE2i-150 dev board PIOs");
+
+/* driver constants */
+
+#define DRIVER_NAME      "ihs_emu"
+#define FILE_NAME        "de2i-150"
+#define DRIVER_CLASS     "MyModuleClass"
+#define EMU_BAR_LEN      0x10000	/* emulated BAR0 length */
+
+/* functions signature */
+
+static int 	__init my_init (void);
+static void 	__exit my_exit (void);
+
+static int	my_open   (struct inode*, struct file*);
+static int 	my_close  (struct inode*, struct file*);
+static loff_t 	my_seek   (struct file*, loff_t, int);
+static ssize_t 	my_read   (struct file*, char __user*, size_t, loff_t*);
+static ssize_t 	my_write  (struct file*, const char __user*, size_t, loff_t*);
+static long int	my_ioctl  (struct file*, unsigned int, unsigned long);
+static int	my_mmap   (struct file*, struct vm_area_struct*);
+static __poll_t	my_poll   (struct file*, poll_table*);
+
+/* lkm entry and exit points */
+
+module_init(my_init);
+module_exit(my_exit);
+
+/* device file operations */
+
+static struct file_operations fops = {
+	.owner = THIS_MODULE,
+	.llseek = my_seek,
+	.read = my_read,
+	.write = my_write,
+	.unlocked_ioctl = my_ioctl,
+	.mmap = my_mmap,
+	.poll = my_poll,
+	.open = my_open,
+	.release = my_close
+};
+
+/* variables for char device registration to kernel */
+
+static dev_t my_device_nbr;
+static struct class* my_class;
+static struct cdev my_device;
+
+/* emulated bus: time a register access keeps the caller busy */
+
+static unsigned int read_latency_ns = 0;
+module_param(read_latency_ns, uint, 0644);
+MODULE_PARM_DESC(read_latency_ns, "busy time of every emulated register read in ns (default 0)");
+
+static unsigned int write_latency_ns = 0;
+module_param(write_latency_ns, uint, 0644);
+MODULE_PARM_DESC(write_latency_ns, "busy time of every emulated register write in ns (default 0)");
+
+/*
+ * fake device: the BAR0 page holding the PIO windows. It is also what
+ * mmap() hands out, so user loads and stores see the same registers.
+ */
+
+static struct page* regs_page;
+static u32* regs;
+static DEFINE_SPINLOCK(regs_lock);
+
+/* offset of each peripheral PIO inside BAR0, indexed by enum ihs_peripheral */
+static const unsigned int periph_offset[] = {
+	SWITCHES_OFF,	/* inport   */
+	PBUTTONS_OFF,	/* button   */
+	HEX_L_OFF,	/* hexport1 */
+	HEX_R_OFF,	/* hexport  */
+	LEDG_OFF,	/* ledg     */
+	LEDR_OFF	/* ledr     */
+};
+
+/* data bits wired to each input PIO */
+#define SWITCHES_MASK ((1u << FPGA_INPORT_WIDTH) - 1)
+#define PBUTTONS_MASK ((1u << FPGA_BUTTON_WIDTH) - 1)
+
+#define REG(idx) regs[PIO_WORD(periph_offset[idx])]
+
+/* input changes made through sysfs, for poll() and RD_EVENTS; regs_lock */
+
+static DECLARE_WAIT_QUEUE_HEAD(input_wq);
+static unsigned long input_seq = 0;
+
+#define EV_RING_LEN 256		/* power of two */
+static struct ihs_event ev_ring[EV_RING_LEN];
+static unsigned long ev_head = 0;
+
+/*
+ * output animation (WR_ANIM); played from a workqueue, the timing of an
+ * emulated board does not need an hrtimer. Frames swapped under regs_lock.
+ */
+
+static void play_frame(struct work_struct*);
+static DECLARE_DELAYED_WORK(anim_work, play_frame);
+static DEFINE_MUTEX(anim_mutex);
+static struct ihs_frame* anim;
+static unsigned int anim_count, anim_pos;
+static bool anim_loop;
+
+/* edges of the inputs since load, scripted values need no debouncing */
+static struct ihs_edges edges;
+
+/* per open file state, kept in filp->private_data */
+struct file_ctx {
+	int rd_idx;		/* peripheral selected for read() by the RD_* ioctls */
+	int wr_idx;		/* peripheral selected for write() by the WR_* ioctls */
+	unsigned long seen_seq;	/* input_seq at this file's last input read */
+	struct ihs_edges edges_seen;	/* edge counts at the last RD_EDGES */
+	bool ev_mode;		/* read() returns the event stream (RD_EVENTS) */
+	unsigned long ev_tail;	/* next event to return, counts like ev_head */
+	struct mutex ev_lock;	/* serializes event reads sharing this file */
+};
+
+static int periph_is_input(unsigned int idx)
+{
+	return idx == PERIPH_SWITCHES || idx == PERIPH_PBUTTONS;
+}
+
+/* peripheral whose data register sits at BAR0 offset 'off', or -1 */
+static int periph_at(loff_t off)
+{
+	int i;
+
+	for (i = 0; i < PERIPH_COUNT; i++)
+		if (periph_offset[i] == off)
+			return i;
+	return -1;
+}
+
+static void bus_delay(unsigned int ns)
+{
+	if (ns >= 1000)
+		udelay(ns / 1000);
+	if (ns % 1000)
+		ndelay(ns % 1000);
+}
+
+/* register accesses; regs_lock held, like the MMIO lock of the real driver */
+static unsigned int emu_read(int idx)
+{
+	bus_delay(READ_ONCE(read_latency_ns));
+	return READ_ONCE(REG(idx));
+}
+
+static void emu_write(int idx, unsigned int value)
+{
+	bus_delay(READ_ONCE(write_latency_ns));
+	WRITE_ONCE(REG(idx), value);
+}
+
+static unsigned int periph_read(int idx)
+{
+	unsigned int value;
+
+	spin_lock(&regs_lock);
+	value = emu_read(idx);
+	spin_unlock(&regs_lock);
+
+	return value;
+}
+
+static void periph_write(int idx, unsigned int value)
+{
+	spin_lock(&regs_lock);
+	emu_write(idx, value);
+	spin_unlock(&regs_lock);
+}
+
+static void play_frame(struct work_struct* work)
+{
+	struct ihs_frame* f;
+	bool again = true;
+
+	spin_lock(&regs_lock);
+	f = &anim[anim_pos];
+	emu_write(PERIPH_RED_LEDS, f->ledr);
+	emu_write(PERIPH_GREEN_LEDS, f->ledg);
+	emu_write(PERIPH_L_DISPLAY, f->hex_l);
+	emu_write(PERIPH_R_DISPLAY, f->hex_r);
+	if (++anim_pos == anim_count) {
+		anim_pos = 0;
+		again = anim_loop;
+	}
+	spin_unlock(&regs_lock);
+
+	if (again)
+		schedule_delayed_work(&anim_work, usecs_to_jiffies(f->delay_us));
+}
+
+/* drive an input from sysfs, recording the change like the real sampler */
+static void input_set(int idx, unsigned int value)
+{
+	struct ihs_event* ev;
+	unsigned long moved;
+	int bit;
+
+	spin_lock(&regs_lock);
+	if (READ_ONCE(REG(idx)) != value) {
+		moved = READ_ONCE(REG(idx)) ^ value;
+		for_each_set_bit(bit, &moved, IHS_INPUT_BITS) {
+			if (value & BIT(bit))
+				edges.rise[idx][bit]++;
+			else
+				edges.fall[idx][bit]++;
+		}
+		edges.level[idx] = value;
+		WRITE_ONCE(REG(idx), value);
+
+		ev = &ev_ring[ev_head & (EV_RING_LEN - 1)];
+		ev->ktime_ns = ktime_get_ns();
+		ev->periph = idx;
+		ev->value = value;
+		ev_head++;
+		input_seq++;
+	}
+	spin_unlock(&regs_lock);
+
+	wake_up_interruptible(&input_wq);
+}
+
+/* scriptable inputs and readable outputs at /sys/class/MyModuleClass/de2i-150/ */
+
+#define INPUT_ATTR(field, idx, mask)						\
+static ssize_t field##_show(struct device* dev, struct device_attribute* attr, char* buf) \
+{									\
+	return sysfs_emit(buf, "0x%x\n", READ_ONCE(REG(idx)));		\
+}									\
+static ssize_t field##_store(struct device* dev, struct device_attribute* attr,	\
+			     const char* buf, size_t count)			\
+{									\
+	unsigned int value;						\
+									\
+	if (kstrtouint(buf, 0, &value) < 0 || value & ~(mask))		\
+		return -EINVAL;						\
+	input_set(idx, value);						\
+	return count;							\
+}									\
+static DEVICE_ATTR_RW(field)
+
+#define OUTPUT_ATTR(field, idx)							\
+static ssize_t field##_show(struct device* dev, struct device_attribute* attr, char* buf) \
+{									\
+	return sysfs_emit(buf, "0x%08x\n", READ_ONCE(REG(idx)));		\
+}									\
+static DEVICE_ATTR_RO(field)
+
+INPUT_ATTR(switches, PERIPH_SWITCHES, SWITCHES_MASK);
+INPUT_ATTR(buttons, PERIPH_PBUTTONS, PBUTTONS_MASK);
+OUTPUT_ATTR(hex_l, PERIPH_L_DISPLAY);
+OUTPUT_ATTR(hex_r, PERIPH_R_DISPLAY);
+OUTPUT_ATTR(ledg, PERIPH_GREEN_LEDS);
+OUTPUT_ATTR(ledr, PERIPH_RED_LEDS);
+
+static struct attribute* emu_attrs[] = {
+	&dev_attr_switches.attr,
+	&dev_attr_buttons.attr,
+	&dev_attr_hex_l.attr,
+	&dev_attr_hex_r.attr,
+	&dev_attr_ledg.attr,
+	&dev_attr_ledr.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(emu);
+
+/* functions implementation */
+
+static int __init my_init(void)
+{
+	printk("my_driver: loaded to the kernel\n");
+
+	/* 0. the emulated registers, push buttons idle high like the board's keys */
+	regs_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (regs_page == NULL)
+		return -ENOMEM;
+	regs = page_address(regs_page);
+	REG(PERIPH_PBUTTONS) = PBUTTONS_MASK;
+	edges.level[PERIPH_PBUTTONS] = PBUTTONS_MASK;
+
+	/* 1. request the kernel for a device number */
+
+	if (alloc_chrdev_region(&my_device_nbr, 0, 1, DRIVER_NAME) < 0) {
+		printk("my_driver: device number could not be allocated!\n");
+		__free_page(regs_page);
+		return -EAGAIN;
+	}
+	printk("my_driver: device number %d was registered!\n", MAJOR(my_device_nbr));
+
+	/* 2. create class : appears at /sys/class */
+
+	my_class = class_create(DRIVER_CLASS);
+	if (IS_ERR(my_class)) {
+		printk("my_driver: device class count not be created!\n");
+		goto ClassError;
+	}
+
+	/* 3. associate the cdev with a set of file operations */
+
+	cdev_init(&my_device, &fops);
+
+	/* 4. create the device node */
+
+	if (IS_ERR(device_create_with_groups(my_class, NULL, my_device_nbr, NULL, emu_groups, FILE_NAME))) {
+		printk("my_driver: can not create device file!\n");
+		goto FileError;
+	}
+
+	/* 5. now make the device live for the users to access */
+
+	if (cdev_add(&my_device, my_device_nbr, 1) < 0) {
+		printk("my_driver: registering of device to kernel failed!\n");
+		goto AddError;
+	}
+
+	return 0;
+
+AddError:
+	device_destroy(my_class, my_device_nbr);
+FileError:
+	class_destroy(my_class);
+ClassError:
+	unregister_chrdev_region(my_device_nbr, 1);
+	__free_page(regs_page);
+	return -EAGAIN;
+}
+
+static void __exit my_exit(void)
+{
+	cdev_del(&my_device);
+	device_destroy(my_class, my_device_nbr);
+	class_destroy(my_class);
+	unregister_chrdev_region(my_device_nbr, 1);
+	cancel_delayed_work_sync(&anim_work);
+	kfree(anim);
+	__free_page(regs_page);
+	printk("my_driver: goodbye kernel!\n");
+}
+
+static int my_open(struct inode* inode, struct file* filp)
+{
+	struct file_ctx* ctx;
+
+	pr_debug("my_driver: open was called\n");
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (ctx == NULL)
+		return -ENOMEM;
+
+	/* default peripheral read and write selection */
+	ctx->rd_idx = PERIPH_SWITCHES;
+	ctx->wr_idx = PERIPH_R_DISPLAY;
+	ctx->seen_seq = READ_ONCE(input_seq);
+	mutex_init(&ctx->ev_lock);
+
+	spin_lock(&regs_lock);
+	ctx->edges_seen = edges;
+	spin_unlock(&regs_lock);
+	filp->private_data = ctx;
+
+	return 0;
+}
+
+static int my_close(struct inode* inode, struct file* filp)
+{
+	pr_debug("my_driver: close was called\n");
+	kfree(filp->private_data);
+	return 0;
+}
+
+static loff_t my_seek(struct file* filp, loff_t off, int whence)
+{
+	loff_t new_pos;
+
+	switch(whence) {
+	case 0: /* SEEK_SET */
+		new_pos = off;
+		break;
+	case 1: /* SEEK_CUR */
+		new_pos = filp->f_pos + off;
+		break;
+	case 2: /* SEEK_END */
+		new_pos = EMU_BAR_LEN + off;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (new_pos < 0 || new_pos > EMU_BAR_LEN)
+		return -EINVAL;
+
+	filp->f_pos = new_pos;
+	return new_pos;
+}
+
+/* validate an offset-addressed access against the PIO windows */
+static int pio_check(loff_t off, size_t count)
+{
+	if ((off | count) & 3)
+		return -EINVAL;
+	if (off < PIO_BASE || off > PIO_END || count > PIO_END - off)
+		return -EINVAL;
+	return 0;
+}
+
+static ssize_t pio_read(char __user* buf, size_t count, loff_t* f_pos)
+{
+	unsigned int words[PIO_WORD(PIO_END)];
+	loff_t off = *f_pos;
+	size_t i, n = count / 4;
+	int ret, idx;
+
+	if ((ret = pio_check(off, count)) < 0)
+		return ret;
+
+	spin_lock(&regs_lock);
+	for (i = 0; i < n; i++) {
+		idx = periph_at(off + 4 * i);
+		words[i] = (idx < 0) ? 0 : emu_read(idx);
+	}
+	spin_unlock(&regs_lock);
+
+	if (copy_to_user(buf, words, count))
+		return -EFAULT;
+
+	*f_pos += count;
+	return count;
+}
+
+static ssize_t pio_write(const char __user* buf, size_t count, loff_t* f_pos)
+{
+	unsigned int words[PIO_WORD(PIO_END)];
+	loff_t off = *f_pos;
+	size_t i, n = count / 4;
+	int ret, idx;
+
+	if ((ret = pio_check(off, count)) < 0)
+		return ret;
+
+	if (copy_from_user(words, buf, count))
+		return -EFAULT;
+
+	spin_lock(&regs_lock);
+	for (i = 0; i < n; i++) {
+		idx = periph_at(off + 4 * i);
+		if (idx >= 0 && !periph_is_input(idx))
+			emu_write(idx, words[i]);
+	}
+	spin_unlock(&regs_lock);
+
+	*f_pos += count;
+	return count;
+}
+
+/* copy pending input change records to buf; ev_lock held */
+static ssize_t ev_read_locked(struct file_ctx* ctx, char __user* buf, size_t max)
+{
+	struct ihs_event ev;
+	size_t done = 0;
+
+	while (done < max) {
+		spin_lock(&regs_lock);
+		if (ev_head == ctx->ev_tail) {
+			spin_unlock(&regs_lock);
+			break;
+		}
+		if (ev_head - ctx->ev_tail > EV_RING_LEN) {
+			/* the scripts outran this reader: report, then skip ahead */
+			ev.ktime_ns = ktime_get_ns();
+			ev.periph = EV_OVERFLOW;
+			ev.value = ev_head - ctx->ev_tail - EV_RING_LEN;
+			ctx->ev_tail = ev_head - EV_RING_LEN;
+		} else {
+			ev = ev_ring[ctx->ev_tail++ & (EV_RING_LEN - 1)];
+		}
+		spin_unlock(&regs_lock);
+
+		if (copy_to_user(buf + done * sizeof(ev), &ev, sizeof(ev)))
+			return done ? done * sizeof(ev) : -EFAULT;
+		done++;
+	}
+
+	return done * sizeof(struct ihs_event);
+}
+
+static ssize_t ev_read(struct file* filp, struct file_ctx* ctx, char __user* buf, size_t count)
+{
+	size_t max = count / sizeof(struct ihs_event);
+	ssize_t retval;
+
+	if (max == 0)
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&ctx->ev_lock))
+		return -ERESTARTSYS;
+
+	while (READ_ONCE(ev_head) == ctx->ev_tail) {
+		mutex_unlock(&ctx->ev_lock);
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(input_wq, READ_ONCE(ev_head) != READ_ONCE(ctx->ev_tail)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&ctx->ev_lock))
+			return -ERESTARTSYS;
+	}
+
+	retval = ev_read_locked(ctx, buf, max);
+	mutex_unlock(&ctx->ev_lock);
+
+	return retval;
+}
+
+static ssize_t my_read(struct file* filp, char __user* buf, size_t count, loff_t* f_pos)
+{
+	struct file_ctx* ctx = filp->private_data;
+	unsigned int temp_read;
+	int to_cpy;
+
+	/* a non-zero offset addresses BAR0 directly (pread/preadv) */
+	if (*f_pos != 0)
+		return pio_read(buf, count, f_pos);
+
+	/* input change records selected with RD_EVENTS */
+	if (ctx->ev_mode)
+		return ev_read(filp, ctx, buf, count);
+
+	/* an input read here re-arms poll() like RD_INPUTS does */
+	if (periph_is_input(ctx->rd_idx)) {
+		spin_lock(&regs_lock);
+		temp_read = emu_read(ctx->rd_idx);
+		ctx->seen_seq = input_seq;
+		spin_unlock(&regs_lock);
+	} else {
+		temp_read = periph_read(ctx->rd_idx);
+	}
+	to_cpy = (count <= sizeof(temp_read)) ? count : sizeof(temp_read);
+
+	return to_cpy - copy_to_user(buf, &temp_read, to_cpy);
+}
+
+static ssize_t my_write(struct file* filp, const char __user* buf, size_t count, loff_t* f_pos)
+{
+	struct file_ctx* ctx = filp->private_data;
+	unsigned int temp_write = 0;
+	ssize_t retval;
+	int to_cpy;
+
+	/* a non-zero offset addresses BAR0 directly (pwrite/pwritev) */
+	if (*f_pos != 0)
+		return pio_write(buf, count, f_pos);
+
+	to_cpy = (count <= sizeof(temp_write)) ? count : sizeof(temp_write);
+	retval = to_cpy - copy_from_user(&temp_write, buf, to_cpy);
+
+	/* writes to an input PIO are ignored by the hardware too */
+	if (!periph_is_input(ctx->wr_idx))
+		periph_write(ctx->wr_idx, temp_write);
+
+	return retval;
+}
+
+static long int my_ioctl_reg(unsigned int cmd, unsigned long arg)
+{
+	struct ihs_reg reg;
+
+	if (copy_from_user(&reg, (void __user*)arg, sizeof(reg)))
+		return -EFAULT;
+
+	if (reg.periph >= PERIPH_COUNT)
+		return -EINVAL;
+
+	if (cmd == WR_REG) {
+		if (periph_is_input(reg.periph))
+			return -EINVAL;
+		periph_write(reg.periph, reg.value);
+		return 0;
+	}
+
+	reg.value = periph_read(reg.periph);
+	if (copy_to_user((void __user*)arg, &reg, sizeof(reg)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static long int my_ioctl_inputs(struct file_ctx* ctx, unsigned long arg)
+{
+	struct ihs_inputs in;
+
+	spin_lock(&regs_lock);
+	in.switches = emu_read(PERIPH_SWITCHES);
+	in.buttons = emu_read(PERIPH_PBUTTONS);
+	ctx->seen_seq = input_seq;
+	spin_unlock(&regs_lock);
+
+	if (copy_to_user((void __user*)arg, &in, sizeof(in)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static long int my_ioctl_edges(struct file_ctx* ctx, unsigned long arg)
+{
+	struct ihs_edges now, out;
+	int i, bit;
+
+	spin_lock(&regs_lock);
+	now = edges;
+	spin_unlock(&regs_lock);
+
+	for (i = 0; i < 2; i++) {
+		out.level[i] = now.level[i];
+		for (bit = 0; bit < IHS_INPUT_BITS; bit++) {
+			out.rise[i][bit] = now.rise[i][bit] - ctx->edges_seen.rise[i][bit];
+			out.fall[i][bit] = now.fall[i][bit] - ctx->edges_seen.fall[i][bit];
+		}
+	}
+
+	if (copy_to_user((void __user*)arg, &out, sizeof(out)))
+		return -EFAULT;
+
+	ctx->edges_seen = now;
+	return 0;
+}
+
+static long int my_ioctl_anim(unsigned long arg)
+{
+	struct ihs_frame *frames = NULL, *old;
+	struct ihs_anim a;
+	unsigned int i;
+
+	if (copy_from_user(&a, (void __user*)arg, sizeof(a)))
+		return -EFAULT;
+
+	if (a.count > ANIM_MAX_FRAMES || (a.flags & ~ANIM_LOOP))
+		return -EINVAL;
+
+	if (a.count) {
+		frames = memdup_user(u64_to_user_ptr(a.frames), a.count * sizeof(*frames));
+		if (IS_ERR(frames))
+			return PTR_ERR(frames);
+		for (i = 0; i < a.count; i++) {
+			if (frames[i].delay_us < ANIM_MIN_DELAY_US) {
+				kfree(frames);
+				return -EINVAL;
+			}
+		}
+	}
+
+	mutex_lock(&anim_mutex);
+	cancel_delayed_work_sync(&anim_work);
+
+	spin_lock(&regs_lock);
+	old = anim;
+	anim = frames;
+	anim_count = a.count;
+	anim_pos = 0;
+	anim_loop = a.flags & ANIM_LOOP;
+	spin_unlock(&regs_lock);
+
+	if (frames != NULL)
+		schedule_delayed_work(&anim_work, 0);
+	mutex_unlock(&anim_mutex);
+
+	kfree(old);
+	return 0;
+}
+
+static long int my_ioctl(struct file* filp, unsigned int cmd, unsigned long arg)
+{
+	struct file_ctx* ctx = filp->private_data;
+
+	/* the selection only affects this open file */
+	switch(cmd){
+	case RD_SWITCHES:
+		ctx->rd_idx = PERIPH_SWITCHES;
+		ctx->ev_mode = false;
+		break;
+	case RD_PBUTTONS:
+		ctx->rd_idx = PERIPH_PBUTTONS;
+		ctx->ev_mode = false;
+		break;
+	case RD_EVENTS:
+		/* the stream starts with the next change */
+		mutex_lock(&ctx->ev_lock);
+		ctx->ev_tail = READ_ONCE(ev_head);
+		ctx->ev_mode = true;
+		mutex_unlock(&ctx->ev_lock);
+		break;
+	case WR_L_DISPLAY:
+		ctx->wr_idx = PERIPH_L_DISPLAY;
+		break;
+	case WR_R_DISPLAY:
+		ctx->wr_idx = PERIPH_R_DISPLAY;
+		break;
+	case WR_RED_LEDS:
+		ctx->wr_idx = PERIPH_RED_LEDS;
+		break;
+	case WR_GREEN_LEDS:
+		ctx->wr_idx = PERIPH_GREEN_LEDS;
+		break;
+	case WR_REG:
+	case RD_REG:
+		return my_ioctl_reg(cmd, arg);
+	case RD_INPUTS:
+		return my_ioctl_inputs(ctx, arg);
+	case RD_EDGES:
+		return my_ioctl_edges(ctx, arg);
+	case WR_ANIM:
+		return my_ioctl_anim(arg);
+	case WR_SYNC:
+		/* emulated writes are never queued */
+		break;
+	default:
+		pr_debug("my_driver: unknown ioctl command: 0x%X\n", cmd);
+		return -ENOTTY;
+	}
+	return 0;
+}
+
+static __poll_t my_poll(struct file* filp, poll_table* wait)
+{
+	struct file_ctx* ctx = filp->private_data;
+	__poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+	poll_wait(filp, &input_wq, wait);
+
+	/* readable once a script changed an input this file has not fetched */
+	if (ctx->ev_mode) {
+		if (READ_ONCE(ev_head) != READ_ONCE(ctx->ev_tail))
+			mask |= EPOLLIN | EPOLLRDNORM;
+	} else if (READ_ONCE(input_seq) != ctx->seen_seq) {
+		mask |= EPOLLIN | EPOLLRDNORM;
+	}
+
+	return mask;
+}
+
+static int my_mmap(struct file* filp, struct vm_area_struct* vma)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	/* same window as the real driver: the page holding the PIOs, at PIO_BASE */
+	if (vma->vm_pgoff != (PIO_BASE >> PAGE_SHIFT) || size > PAGE_SIZE)
+		return -EINVAL;
+
+	/* registers can't be copied on write, the real driver refuses it too */
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	/* user stores land in the register page without any bus latency */
+	return remap_pfn_range(vma, vma->vm_start, page_to_pfn(regs_page),
+			       size, vma->vm_page_prot);
+}
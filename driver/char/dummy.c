@@ -5,6 +5,15 @@
 #include <linux/types.h>	/* dev_t number */
 #include <linux/cdev.h>		/* char device registration */
 #include <linux/uaccess.h>	/* copy_*_user functions */
+#include <linux/ioctl.h>	/* ioctl syscall */
+#include <linux/mm.h>		/* mmap related */
+#include <linux/vmalloc.h>	/* ring memory */
+#include <linux/log2.h>		/* power of two sizes */
+#include <linux/mutex.h>	/* reader/writer serialization */
+#include <linux/wait.h>		/* wait queues */
+#include <linux/poll.h>		/* poll syscall */
+
+#include "../../include/ring_cmds.h"
 
 /* meta information */
 
@@ -19,9 +28,11 @@ static void 	__exit my_exit (void);
 
 static int	my_open   (struct inode*, struct file*);
 static int 	my_close  (struct inode*, struct file*);
-static loff_t 	my_seek   (struct file*, loff_t, int);
 static ssize_t 	my_read   (struct file*, char __user*, size_t, loff_t*);
 static ssize_t 	my_write  (struct file*, const char __user*, size_t, loff_t*);
+static long int	my_ioctl  (struct file*, unsigned int, unsigned long);
+static int	my_mmap   (struct file*, struct vm_area_struct*);
+static __poll_t	my_poll   (struct file*, poll_table*);
 
 /* lkm entry and exit points */
 
@@ -32,9 +43,11 @@ module_exit(my_exit);
 
 static struct file_operations fops = {
 	.owner = THIS_MODULE,
-	.llseek = my_seek,
 	.read = my_read,
 	.write = my_write,
+	.unlocked_ioctl = my_ioctl,
+	.mmap = my_mmap,
+	.poll = my_poll,
 	.open = my_open,
 	.release = my_close
 };
@@ -49,11 +62,27 @@ static struct cdev my_device;
 #define FILE_NAME 	"mydev"
 #define DRIVER_CLASS 	"MyModuleClass"
 
-/* fake device */
+/*
+ * fake device: a ring buffer shared by every opener. head and tail count
+ * the bytes ever written and read, so head - tail is the fill level and
+ * the ring position is the count modulo the size.
+ */
+
+static unsigned int buffer_size = 65536;
+module_param(buffer_size, uint, 0444);
+MODULE_PARM_DESC(buffer_size, "ring size in bytes, rounded up to a power of two of at least a page (default 65536)");
+
+static char* device_mem;
+static unsigned long ring_size;
 
-#define BUFFER_LEN 255
-static char device_mem[BUFFER_LEN];
-static int buffer_index = 0;
+static unsigned long head = 0;		/* written under wr_lock */
+static unsigned long tail = 0;		/* written under rd_lock */
+
+/* one writer and one reader copying at a time, any number of them waiting */
+static DEFINE_MUTEX(wr_lock);
+static DEFINE_MUTEX(rd_lock);
+static DECLARE_WAIT_QUEUE_HEAD(rd_wq);	/* readers waiting for data */
+static DECLARE_WAIT_QUEUE_HEAD(wr_wq);	/* writers waiting for room */
 
 /* functions implementation */
 
@@ -61,35 +90,44 @@ static int __init my_init(void)
 {
 	printk("my_driver: loaded to the kernel\n");
 
+	/* 0. the ring, vmalloc_user() memory can be mapped to user space */
+
+	ring_size = roundup_pow_of_two(max_t(unsigned long, buffer_size, PAGE_SIZE));
+	if ((device_mem = vmalloc_user(ring_size)) == NULL) {
+		printk("my_driver: ring of %lu bytes could not be allocated!\n", ring_size);
+		return -ENOMEM;
+	}
+
 	/* 1. request the kernel for a device number */
 
 	if (alloc_chrdev_region(&my_device_nbr, 0, 1, DRIVER_NAME) < 0) {
 		printk("my_driver: device number could not be allocated!\n");
-		return -EAGAIN;
+		goto RegionError;
 	}
 	printk("my_driver: device number %d was registered!\n", MAJOR(my_device_nbr));
 
 	/* 2. create class : appears at /sys/class */
 
-	if ((my_class = class_create(THIS_MODULE, DRIVER_CLASS)) == NULL) {
+	my_class = class_create(DRIVER_CLASS);
+	if (IS_ERR(my_class)) {
 		printk("my_driver: device class count not be created!\n");
 		goto ClassError;
 	}
 
 	/* 3. associate the cdev with a set of file operations */
-	
+
 	cdev_init(&my_device, &fops);
 
 	/* 4. create the device node */
 
-	if (device_create(my_class, NULL, my_device_nbr, NULL, FILE_NAME) == NULL) {
+	if (IS_ERR(device_create(my_class, NULL, my_device_nbr, NULL, FILE_NAME))) {
 		printk("my_driver: can not create device file!\n");
 		goto FileError;
 	}
 
 	/* 5. now make the device live for the users to access */
-	
-	if (cdev_add(&my_device, my_device_nbr, 1) == -1){
+
+	if (cdev_add(&my_device, my_device_nbr, 1) < 0) {
 		printk("my_driver: registering of device to kernel failed!\n");
 		goto AddError;
 	}
@@ -101,7 +139,9 @@ AddError:
 FileError:
 	class_destroy(my_class);
 ClassError:
-	unregister_chrdev(my_device_nbr, DRIVER_NAME);
+	unregister_chrdev_region(my_device_nbr, 1);
+RegionError:
+	vfree(device_mem);
 	return -EAGAIN;
 }
 
@@ -110,91 +150,195 @@ static void __exit my_exit(void)
 	cdev_del(&my_device);
 	device_destroy(my_class, my_device_nbr);
 	class_destroy(my_class);
-	unregister_chrdev(my_device_nbr, DRIVER_NAME);
+	unregister_chrdev_region(my_device_nbr, 1);
+	vfree(device_mem);
 	printk("my_driver: goodbye kernel!\n");
 }
 
 static int my_open(struct inode* inode, struct file* filp)
 {
-	printk("my_driver: open was called\n");
-	return 0;
+	pr_debug("my_driver: open was called\n");
+
+	/* a stream like a pipe: no file position, no seeking */
+	return stream_open(inode, filp);
 }
 
 static int my_close(struct inode* inode, struct file* filp)
 {
-	printk("my_driver: close was called\n");
+	pr_debug("my_driver: close was called\n");
 	return 0;
 }
 
-static loff_t my_seek(struct file* filp, loff_t off, int whence)
+static unsigned long ring_used(void)
 {
-	loff_t new_pos;
-
-	switch(whence) {
-	case 0: /* SEEK_SET */
-		new_pos = off;
-		break;
-	case 1: /* SEEK_CUR */
-		new_pos = filp->f_pos + off;
-		break;
-	case 2: /* SEEK_END */
-		new_pos = BUFFER_LEN + off; //TODO: this might be wrong
-		break;
-	default: /* can't happen */
-		new_pos = -EINVAL;
-		goto SeekOut;
-	}
-	filp->f_pos = new_pos;
+	return smp_load_acquire(&head) - READ_ONCE(tail);
+}
 
-SeekOut:
-	return new_pos;
+static unsigned long ring_free(void)
+{
+	return ring_size - (READ_ONCE(head) - smp_load_acquire(&tail));
+}
 
+/*
+ * take the lock of one side of the ring. It is only held while copying,
+ * never while waiting, and an O_NONBLOCK file doesn't wait for it either.
+ */
+static int ring_lock(struct file* filp, struct mutex* lock)
+{
+	if (filp->f_flags & O_NONBLOCK)
+		return mutex_trylock(lock) ? 0 : -EAGAIN;
+	return mutex_lock_interruptible(lock) ? -ERESTARTSYS : 0;
 }
 
 static ssize_t my_read(struct file* filp, char __user* buf, size_t count, loff_t* f_pos)
 {
-	ssize_t retval = 0;
-	int to_cpy = 0;
-
-	/* check if there is something to read */
-	if (*f_pos >= buffer_index) {
-		printk("my_driver: trying to read a empty buffer region");
-		goto ReadOut;
+	unsigned long pos, to_cpy, first;
+	ssize_t retval;
+
+	if (count == 0)
+		return 0;
+
+	if ((retval = ring_lock(filp, &rd_lock)) < 0)
+		return retval;
+
+	/* wait for data without the lock, like a pipe, and check again once back */
+	while (ring_used() == 0) {
+		mutex_unlock(&rd_lock);
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(rd_wq, ring_used() != 0))
+			return -ERESTARTSYS;
+		if ((retval = ring_lock(filp, &rd_lock)) < 0)
+			return retval;
 	}
 
-	/* get amount of bytes to copy to user */
-	to_cpy = (count <= buffer_index - *f_pos) ? count : buffer_index - *f_pos;
+	/* get amount of bytes to copy to user, in up to two pieces */
+	to_cpy = min_t(unsigned long, count, ring_used());
+	pos = tail & (ring_size - 1);
+	first = min(to_cpy, ring_size - pos);
 
 	/* copy data to user */
-	retval = to_cpy - copy_to_user(buf, device_mem + *f_pos, to_cpy);
+	retval = -EFAULT;
+	if (copy_to_user(buf, device_mem + pos, first))
+		goto ReadOut;
+	if (copy_to_user(buf + first, device_mem, to_cpy - first))
+		goto ReadOut;
 
-	/* update the file position */
-	*f_pos += retval;
+	/* release the room to the writers */
+	smp_store_release(&tail, tail + to_cpy);
+	wake_up_interruptible(&wr_wq);
+	retval = to_cpy;
 
 ReadOut:
+	mutex_unlock(&rd_lock);
 	return retval;
 }
 
 static ssize_t my_write(struct file* filp, const char __user* buf, size_t count, loff_t* f_pos)
 {
-	ssize_t retval = 0;
-	int to_cpy = 0;
-
-	/* check if the buffer is full */
-	if (buffer_index >= BUFFER_LEN) {
-		printk("my_driver: trying to write in a full buffer");
-		goto WriteOut;
+	unsigned long pos, to_cpy, first;
+	ssize_t retval;
+
+	if (count == 0)
+		return 0;
+
+	if ((retval = ring_lock(filp, &wr_lock)) < 0)
+		return retval;
+
+	/* wait for room, a full ring blocks like a full pipe */
+	while (ring_free() == 0) {
+		mutex_unlock(&wr_lock);
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(wr_wq, ring_free() != 0))
+			return -ERESTARTSYS;
+		if ((retval = ring_lock(filp, &wr_lock)) < 0)
+			return retval;
 	}
 
-	/* get amount of data to copy */
-	to_cpy = (count <= BUFFER_LEN - buffer_index) ? count : BUFFER_LEN - buffer_index;
+	/* get amount of data to copy, in up to two pieces */
+	to_cpy = min_t(unsigned long, count, ring_free());
+	pos = head & (ring_size - 1);
+	first = min(to_cpy, ring_size - pos);
 
 	/* copy data from user */
-	retval = to_cpy - copy_from_user(device_mem + buffer_index, buf, to_cpy);
+	retval = -EFAULT;
+	if (copy_from_user(device_mem + pos, buf, first))
+		goto WriteOut;
+	if (copy_from_user(device_mem, buf + first, to_cpy - first))
+		goto WriteOut;
 
-	/* update buffer_index position */
-	buffer_index += retval;
+	/* publish the data to the readers */
+	smp_store_release(&head, head + to_cpy);
+	wake_up_interruptible(&rd_wq);
+	retval = to_cpy;
 
 WriteOut:
+	mutex_unlock(&wr_lock);
 	return retval;
 }
+
+static long int my_ioctl(struct file* filp, unsigned int cmd, unsigned long arg)
+{
+	struct ring_state st;
+	long int retval = 0;
+
+	switch (cmd) {
+	case RING_STATE:
+		st.tail = smp_load_acquire(&tail);
+		st.head = smp_load_acquire(&head);
+		st.size = ring_size;
+		if (copy_to_user((void __user*)arg, &st, sizeof(st)))
+			return -EFAULT;
+		break;
+	case RING_PRODUCE:
+		/* the producer filled the mapping in place, publish it */
+		if (mutex_lock_interruptible(&wr_lock))
+			return -ERESTARTSYS;
+		if (arg > ring_free()) {
+			retval = -EINVAL;
+		} else {
+			smp_store_release(&head, head + arg);
+			wake_up_interruptible(&rd_wq);
+		}
+		mutex_unlock(&wr_lock);
+		break;
+	case RING_CONSUME:
+		/* the consumer is done with data it used in place */
+		if (mutex_lock_interruptible(&rd_lock))
+			return -ERESTARTSYS;
+		if (arg > ring_used()) {
+			retval = -EINVAL;
+		} else {
+			smp_store_release(&tail, tail + arg);
+			wake_up_interruptible(&wr_wq);
+		}
+		mutex_unlock(&rd_lock);
+		break;
+	default:
+		return -ENOTTY;
+	}
+
+	return retval;
+}
+
+static __poll_t my_poll(struct file* filp, poll_table* wait)
+{
+	__poll_t mask = 0;
+
+	poll_wait(filp, &rd_wq, wait);
+	poll_wait(filp, &wr_wq, wait);
+
+	if (ring_used() != 0)
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (ring_free() != 0)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	return mask;
+}
+
+static int my_mmap(struct file* filp, struct vm_area_struct* vma)
+{
+	/* the ring itself, checked against its size by the helper */
+	return remap_vmalloc_range(vma, device_mem, vma->vm_pgoff);
+}
@@ -0,0 +1,88 @@
+/* tracepoints of the de2i-150 driver, see /sys/kernel/tracing/events/de2i_150 */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM de2i_150
+
+#if !defined(_DE2I_150_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _DE2I_150_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#include "../../include/ioctl_cmds.h"
+
+#define show_periph(idx)					\
+	__print_symbolic(idx,					\
+		{ PERIPH_SWITCHES,   "switches" },		\
+		{ PERIPH_PBUTTONS,   "p_buttons" },		\
+		{ PERIPH_L_DISPLAY,  "display_l" },		\
+		{ PERIPH_R_DISPLAY,  "display_r" },		\
+		{ PERIPH_GREEN_LEDS, "green_leds" },		\
+		{ PERIPH_RED_LEDS,   "red_leds" })
+
+/* legacy RD_* / WR_* command re-aiming an open file */
+TRACE_EVENT(de2i_150_select,
+
+	TP_PROTO(int board, unsigned int cmd, int periph),
+
+	TP_ARGS(board, cmd, periph),
+
+	TP_STRUCT__entry(
+		__field(int,		board)
+		__field(unsigned int,	cmd)
+		__field(int,		periph)
+	),
+
+	TP_fast_assign(
+		__entry->board = board;
+		__entry->cmd = cmd;
+		__entry->periph = periph;
+	),
+
+	TP_printk("board=%d cmd=0x%x periph=%s", __entry->board, __entry->cmd,
+		  show_periph(__entry->periph))
+);
+
+/* one 32-bit MMIO access and how long the bus took to complete it */
+DECLARE_EVENT_CLASS(de2i_150_access,
+
+	TP_PROTO(int board, int periph, u32 value, u64 duration_ns),
+
+	TP_ARGS(board, periph, value, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(int,	board)
+		__field(int,	periph)
+		__field(u32,	value)
+		__field(u64,	duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->board = board;
+		__entry->periph = periph;
+		__entry->value = value;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("board=%d periph=%s value=0x%x duration=%llu ns",
+		  __entry->board, show_periph(__entry->periph), __entry->value,
+		  __entry->duration_ns)
+);
+
+DEFINE_EVENT(de2i_150_access, de2i_150_read,
+	TP_PROTO(int board, int periph, u32 value, u64 duration_ns),
+	TP_ARGS(board, periph, value, duration_ns)
+);
+
+DEFINE_EVENT(de2i_150_access, de2i_150_write,
+	TP_PROTO(int board, int periph, u32 value, u64 duration_ns),
+	TP_ARGS(board, periph, value, duration_ns)
+);
+
+#endif /* _DE2I_150_TRACE_H */
+
+/* this part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE de2i-150-trace
+#include <trace/define_trace.h>
@@ -8,9 +8,27 @@
 #include <linux/cdev.h>		/* char device registration */
 #include <linux/uaccess.h>	/* copy_*_user functions */
 #include <linux/pci.h>		/* pci funcs and types */
+#include <linux/mm.h>		/* mmap related */
+#include <linux/capability.h>	/* capable() */
+#include <linux/slab.h>		/* kzalloc/kfree */
+#include <linux/spinlock.h>	/* MMIO serialization */
+#include <linux/ktime.h>	/* access duration for tracing */
+#include <linux/hrtimer.h>	/* input sampler */
+#include <linux/wait.h>		/* wait queues */
+#include <linux/poll.h>		/* poll syscall */
+#include <linux/mutex.h>	/* sampler start/stop */
+#include <linux/debugfs.h>	/* statistics and histograms */
+#include <linux/seq_file.h>	/* debugfs file contents */
+#include <linux/log2.h>		/* histogram buckets */
+#include <linux/kref.h>		/* board lifetime */
+#include <linux/workqueue.h>	/* posted writes */
+#include <linux/rwsem.h>	/* mapping revocation */
 
 #include "../../include/ioctl_cmds.h"
 
+#define CREATE_TRACE_POINTS
+#include "de2i-150-trace.h"
+
 /* meta information */
 
 MODULE_LICENSE("GPL");
@@ -34,14 +52,36 @@ static void __exit my_exit (void);
 
 static int	my_open   (struct inode*, struct file*);
 static int 	my_close  (struct inode*, struct file*);
+static loff_t 	my_seek   (struct file*, loff_t, int);
 static ssize_t 	my_read   (struct file*, char __user*, size_t, loff_t*);
 static ssize_t 	my_write  (struct file*, const char __user*, size_t, loff_t*);
+static int	my_fsync  (struct file*, loff_t, loff_t, int);
 static long int	my_ioctl  (struct file*, unsigned int, unsigned long);
+static int	my_mmap   (struct file*, struct vm_area_struct*);
+static __poll_t	my_poll   (struct file*, poll_table*);
+
+/* per board state */
+
+struct board;
+
+/* input sampler */
+
+static void sampler_start (struct board*);
+static void sampler_stop  (struct board*);
+static enum hrtimer_restart sample_inputs (struct hrtimer*);
+
+/* output animation */
+
+static enum hrtimer_restart play_frame (struct hrtimer*);
+
+/* debugfs statistics */
+
+static void dbg_init (struct board*);
 
 /* pci functions */
 
-static int  __init my_pci_probe  (struct pci_dev *dev, const struct pci_device_id *id);
-static void __exit my_pci_remove (struct pci_dev *dev);
+static int  my_pci_probe  (struct pci_dev *dev, const struct pci_device_id *id);
+static void my_pci_remove (struct pci_dev *dev);
 
 /* pci ids which this driver supports */
 
@@ -55,9 +95,13 @@ MODULE_DEVICE_TABLE(pci, pci_ids);
 
 static struct file_operations fops = {
 	.owner = THIS_MODULE,
+	.llseek = my_seek,
 	.read = my_read,
 	.write = my_write,
+	.fsync = my_fsync,
 	.unlocked_ioctl	= my_ioctl,
+	.mmap = my_mmap,
+	.poll = my_poll,
 	.open = my_open,
 	.release = my_close
 };
@@ -73,19 +117,168 @@ static struct pci_driver pci_ops = {
 
 /* variables for char device registration to kernel */
 
+#define MAX_BOARDS 8	/* minors reserved, one per board */
+
 static dev_t my_device_nbr;
 static struct class* my_class;
-static struct cdev my_device;
 
-/* --- device data --- */
-/* PCI BARs mapped to virtual space */
-static void __iomem* bar0_mmio = NULL;
+/* drains the writes posted on O_NONBLOCK files of every board */
+static struct workqueue_struct* wr_wq;
+
+/* --- tunables shared by every board --- */
+/* switches and buttons are sampled from an hrtimer while the device is open */
+static unsigned int sample_rate_hz = 1000;
+module_param(sample_rate_hz, uint, 0644);
+MODULE_PARM_DESC(sample_rate_hz, "input sampling rate in Hz, 0 disables the sampler (default 1000)");
+
+static bool elide_writes = true;
+module_param(elide_writes, bool, 0644);
+MODULE_PARM_DESC(elide_writes, "skip output writes of the value the register already holds (default on)");
+
+static unsigned int read_cache_us = 0;
+module_param(read_cache_us, uint, 0644);
+MODULE_PARM_DESC(read_cache_us, "serve input reads from the last sample if younger than this, 0 disables (default 0)");
+
+static unsigned int debounce_us = 5000;
+module_param(debounce_us, uint, 0644);
+MODULE_PARM_DESC(debounce_us, "time an input bit must hold a new level before RD_EDGES reports it, 0 disables (default 5000)");
+
+static bool latency_stats = true;
+module_param(latency_stats, bool, 0644);
+MODULE_PARM_DESC(latency_stats, "collect MMIO and syscall latency histograms (default on)");
+
+/* --- debugfs statistics at /sys/kernel/debug/<board name>/ --- */
+enum dbg_op {
+	OP_IOCTL = 0,
+	OP_READ,
+	OP_WRITE,
+	OP_COUNT
+};
+
+/* row for calls not bound to a single peripheral (spans, events, RD_INPUTS) */
+#define DBG_MULTI PERIPH_COUNT
+
+struct periph_dbg {
+	atomic_long_t calls[OP_COUNT];
+	atomic_long_t bytes;
+	atomic_long_t errors;
+};
+
+/* log2 histogram: bucket i counts durations in [2^i, 2^(i+1)) ns */
+#define HIST_BUCKETS 32
+struct lat_hist {
+	atomic_long_t bucket[HIST_BUCKETS];
+};
+
+/*
+ * input change events, written only by sample_locked() under mmio_lock and
+ * read without locks: every reader keeps its own tail and detects records
+ * overwritten under it by comparing against ev_head
+ */
+#define EV_RING_LEN 1024	/* power of two */
+#define EV_BATCH    16		/* records bounced through the stack per copy */
+
+/*
+ * --- device data ---
+ * one per probed board, minor N is /dev/de2i-150 for N == 0 and
+ * /dev/de2i-150-N otherwise. Open files and user mappings hold a reference,
+ * so the state outlives the PCI device; bar0_mmio == NULL tells it is gone.
+ */
+struct board {
+	struct kref ref;
+	int minor;
+	char name[16];			/* device node and debugfs directory */
+	struct cdev* cdev;
+
+	/* PCI BAR0 mapped to virtual space */
+	void __iomem* bar0_mmio;
+	unsigned long bar0_len;
+	resource_size_t bar0_start;
+
+	/* serializes MMIO between openers and against device removal */
+	spinlock_t mmio_lock;
+
+	/* input sampler, runs while openers is non-zero */
+	struct hrtimer sample_timer;
+	wait_queue_head_t input_wq;
+	struct mutex sampler_mutex;
+	int openers;
+
+	/* last sampled inputs, indexed by PERIPH_SWITCHES/PERIPH_PBUTTONS; mmio_lock */
+	unsigned int input_state[2];
+	u64 input_stamp[2];
+	unsigned long input_seq;	/* bumped on every input change */
+	bool sampler_on;
 
-/* MMIO pointers used in write() read() ioctl() */
-static void __iomem* read_pointer  = NULL;
-static void __iomem* write_pointer = NULL;
+	/* debounced inputs and their edges since the board was probed; mmio_lock */
+	bool db_primed[2];
+	unsigned int db_raw[2];			/* previous raw sample */
+	u64 db_since[2][IHS_INPUT_BITS];	/* when each raw bit last changed */
+	struct ihs_edges edges;
 
-/* peripherals names for debugging in dmesg */
+	struct ihs_event ev_ring[EV_RING_LEN];
+	unsigned long ev_head;
+
+	/* last value written to each output; mmio_lock */
+	unsigned int shadow[PERIPH_COUNT];
+	bool shadow_valid[PERIPH_COUNT];
+
+	/* live user mappings of the registers (mmap), which bypass the shadow */
+	atomic_t mmio_mappings;
+
+	/*
+	 * every open file maps through this address_space, so removal can zap
+	 * the user mappings; map_sem keeps faults from refilling them meanwhile
+	 */
+	struct address_space mapping;
+	struct rw_semaphore map_sem;
+
+	/* outputs posted by O_NONBLOCK writers, last value wins; mmio_lock */
+	unsigned int posted[PERIPH_COUNT];
+	unsigned long posted_mask;
+	struct work_struct wr_work;
+
+	/* output animation played by anim_timer; frames swapped under mmio_lock */
+	struct hrtimer anim_timer;
+	struct mutex anim_mutex;	/* serializes WR_ANIM and removal */
+	struct ihs_frame* anim;
+	unsigned int anim_count;
+	unsigned int anim_pos;		/* next frame to play */
+	bool anim_loop;
+
+	/* MMIO transactions performed and avoided, exported in sysfs; mmio_lock */
+	struct {
+		unsigned long reads;
+		unsigned long reads_cached;
+		unsigned long writes;
+		unsigned long writes_elided;
+		unsigned long writes_posted;
+		unsigned long writes_coalesced;
+	} stats;
+
+	struct dentry* dbg_dir;
+	struct periph_dbg dbg_periph[PERIPH_COUNT + 1];
+	struct lat_hist hist_mmio_read, hist_mmio_write;
+	struct lat_hist hist_call[OP_COUNT];
+};
+
+/* boards by minor, a slot is cleared when its device is removed */
+static DEFINE_MUTEX(boards_lock);
+static struct board* boards[MAX_BOARDS];
+
+/* per open file state, kept in filp->private_data */
+struct file_ctx {
+	struct board* b;	/* referenced board */
+	int rd_idx;		/* peripheral selected for read() by the RD_* ioctls */
+	int wr_idx;		/* peripheral selected for write() by the WR_* ioctls */
+	unsigned long seen_seq;	/* input_seq at this file's last input read */
+	struct ihs_edges edges_seen;	/* board edge counts at the last RD_EDGES */
+	bool ev_mode;		/* read() returns the event stream (RD_EVENTS) */
+	unsigned long ev_tail;	/* next event to return, counts like ev_head */
+	struct mutex ev_lock;	/* serializes event reads sharing this file */
+};
+
+/* peripherals names for debugging in dmesg, indexed by enum ihs_peripheral */
 static const char* peripheral[] = {
 	"switches",
 	"p_buttons",
@@ -95,106 +288,775 @@ static const char* peripheral[] = {
 	"red_leds"
 };
 
-enum perf_names_idx {
-	IDX_SWITCH = 0,
-	IDX_PBUTTONS,
-	IDX_DISPLAYL,
-	IDX_DISPLAYR,
-	IDX_GREENLED,
-	IDX_REDLED
+/* offset of each peripheral PIO inside BAR0, indexed by enum ihs_peripheral */
+static const unsigned int periph_offset[] = {
+	SWITCHES_OFF,	/* inport   */
+	PBUTTONS_OFF,	/* button   */
+	HEX_L_OFF,	/* hexport1 */
+	HEX_R_OFF,	/* hexport  */
+	LEDG_OFF,	/* ledg     */
+	LEDR_OFF	/* ledr     */
+};
+
+/* MMIO statistics at /sys/class/MyModuleClass/<board name>/ */
+
+#define STAT_ATTR(field)							\
+static ssize_t field##_show(struct device* dev, struct device_attribute* attr, char* buf) \
+{									\
+	struct board* b = dev_get_drvdata(dev);				\
+									\
+	return sysfs_emit(buf, "%lu\n", READ_ONCE(b->stats.field));	\
+}									\
+static DEVICE_ATTR_RO(field)
+
+STAT_ATTR(reads);
+STAT_ATTR(reads_cached);
+STAT_ATTR(writes);
+STAT_ATTR(writes_elided);
+STAT_ATTR(writes_posted);
+STAT_ATTR(writes_coalesced);
+
+static struct attribute* stats_attrs[] = {
+	&dev_attr_reads.attr,
+	&dev_attr_reads_cached.attr,
+	&dev_attr_writes.attr,
+	&dev_attr_writes_elided.attr,
+	&dev_attr_writes_posted.attr,
+	&dev_attr_writes_coalesced.attr,
+	NULL
 };
-static int wr_name_idx = IDX_DISPLAYR;
-static int rd_name_idx = IDX_SWITCH;
+ATTRIBUTE_GROUPS(stats);
 
 /* functions implementation */
 
 static int __init my_init(void)
 {
-	printk("my_driver: loaded to the kernel\n");
+	int ret;
 
-	/* 0. register pci driver to the kernel */
-	if (pci_register_driver(&pci_ops) < 0) {
-		printk("my_driver: PCI driver registration failed\n");
-		return -EAGAIN;
-	}
+	printk("my_driver: loaded to the kernel\n");
 
-	/* 1. request the kernel for a device number */
-	if (alloc_chrdev_region(&my_device_nbr, 0, 1, DRIVER_NAME) < 0) {
+	/* 1. request the kernel for a device number per board */
+	if (alloc_chrdev_region(&my_device_nbr, 0, MAX_BOARDS, DRIVER_NAME) < 0) {
 		printk("my_driver: device number could not be allocated!\n");
 		return -EAGAIN;
 	}
 	printk("my_driver: device number %d was registered!\n", MAJOR(my_device_nbr));
 
 	/* 2. create class : appears at /sys/class */
-	if ((my_class = class_create(DRIVER_CLASS)) == NULL) {
+	my_class = class_create(DRIVER_CLASS);
+	if (IS_ERR(my_class)) {
 		printk("my_driver: device class count not be created!\n");
+		ret = PTR_ERR(my_class);
 		goto ClassError;
 	}
 
-	/* 3. associate the cdev with a set of file operations */
-	cdev_init(&my_device, &fops);
-
-	/* 4. create the device node */
-	if (device_create(my_class, NULL, my_device_nbr, NULL, FILE_NAME) == NULL) {
-		printk("my_driver: can not create device file!\n");
-		goto FileError;
+	/* 3. worker for the O_NONBLOCK write queue, kept off the busy system queues */
+	wr_wq = alloc_workqueue("de2i-150-wr", WQ_HIGHPRI | WQ_UNBOUND, 0);
+	if (wr_wq == NULL) {
+		printk("my_driver: write queue could not be created!\n");
+		ret = -ENOMEM;
+		goto WqError;
 	}
 
-	/* 5. now make the device live for the users to access */
-	if (cdev_add(&my_device, my_device_nbr, 1) == -1){
-		printk("my_driver: registering of device to kernel failed!\n");
-		goto AddError;
+	/* 4. register pci driver last, probe creates one device node per board */
+	if ((ret = pci_register_driver(&pci_ops)) < 0) {
+		printk("my_driver: PCI driver registration failed\n");
+		goto PciError;
 	}
 
 	return 0;
 
-AddError:
-	device_destroy(my_class, my_device_nbr);
-FileError:
+PciError:
+	destroy_workqueue(wr_wq);
+WqError:
 	class_destroy(my_class);
 ClassError:
-	unregister_chrdev(my_device_nbr, DRIVER_NAME);
-	pci_unregister_driver(&pci_ops);
-	return -EAGAIN;
+	unregister_chrdev_region(my_device_nbr, MAX_BOARDS);
+	return ret;
 }
 
 static void __exit my_exit(void)
 {
-	cdev_del(&my_device);
-	device_destroy(my_class, my_device_nbr);
-	class_destroy(my_class);
-	unregister_chrdev(my_device_nbr, DRIVER_NAME);
+	/* removes every board, see my_pci_remove */
 	pci_unregister_driver(&pci_ops);
+	destroy_workqueue(wr_wq);
+	class_destroy(my_class);
+	unregister_chrdev_region(my_device_nbr, MAX_BOARDS);
 	printk("my_driver: goodbye kernel!\n");
 }
 
+static void board_release(struct kref* ref)
+{
+	struct board* b = container_of(ref, struct board, ref);
+
+	/* the sampler was stopped by the last close, the animation by removal */
+	kfree(b->anim);
+	kvfree(b);
+}
+
 static int my_open(struct inode* inode, struct file* filp)
 {
-	printk("my_driver: open was called\n");
+	struct file_ctx* ctx;
+	struct board* b;
+	unsigned long flags;
+
+	pr_debug("my_driver: open was called\n");
+
+	/* the board may be removed at any time, hold it while the file is open */
+	mutex_lock(&boards_lock);
+	b = boards[iminor(inode)];
+	if (b != NULL)
+		kref_get(&b->ref);
+	mutex_unlock(&boards_lock);
+
+	if (b == NULL)
+		return -ENODEV;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (ctx == NULL) {
+		kref_put(&b->ref, board_release);
+		return -ENOMEM;
+	}
+
+	/* default peripheral read and write selection */
+	ctx->b = b;
+	ctx->rd_idx = PERIPH_SWITCHES;
+	ctx->wr_idx = PERIPH_R_DISPLAY;
+	ctx->seen_seq = READ_ONCE(b->input_seq);
+	mutex_init(&ctx->ev_lock);
+
+	/* one address_space per board, whatever inode the file was opened by */
+	filp->f_mapping = &b->mapping;
+
+	/* edges that happened before the open are not this file's */
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	ctx->edges_seen = b->edges;
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+	filp->private_data = ctx;
+
+	mutex_lock(&b->sampler_mutex);
+	if (b->openers++ == 0)
+		sampler_start(b);
+	mutex_unlock(&b->sampler_mutex);
+
 	return 0;
 }
 
 static int my_close(struct inode* inode, struct file* filp)
 {
-	printk("my_driver: close was called\n");
+	struct file_ctx* ctx = filp->private_data;
+	struct board* b = ctx->b;
+
+	pr_debug("my_driver: close was called\n");
+
+	mutex_lock(&b->sampler_mutex);
+	if (--b->openers == 0)
+		sampler_stop(b);
+	mutex_unlock(&b->sampler_mutex);
+
+	kfree(ctx);
+	kref_put(&b->ref, board_release);
 	return 0;
 }
 
-static ssize_t my_read(struct file* filp, char __user* buf, size_t count, loff_t* f_pos)
+static loff_t my_seek(struct file* filp, loff_t off, int whence)
+{
+	struct file_ctx* ctx = filp->private_data;
+	unsigned long bar0_len = READ_ONCE(ctx->b->bar0_len);
+	loff_t new_pos;
+
+	switch(whence) {
+	case 0: /* SEEK_SET */
+		new_pos = off;
+		break;
+	case 1: /* SEEK_CUR */
+		new_pos = filp->f_pos + off;
+		break;
+	case 2: /* SEEK_END */
+		new_pos = bar0_len + off;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (new_pos < 0 || new_pos > bar0_len)
+		return -EINVAL;
+
+	filp->f_pos = new_pos;
+	return new_pos;
+}
+
+static int periph_is_input(unsigned int idx)
+{
+	return idx == PERIPH_SWITCHES || idx == PERIPH_PBUTTONS;
+}
+
+/* peripheral whose data register sits at BAR0 offset 'off', or -1 */
+static int periph_at(loff_t off)
+{
+	int i;
+
+	for (i = 0; i < PERIPH_COUNT; i++)
+		if (periph_offset[i] == off)
+			return i;
+	return -1;
+}
+
+static void hist_add(struct lat_hist* hist, u64 ns)
+{
+	int b = ns ? ilog2(ns) : 0;
+
+	atomic_long_inc(&hist->bucket[min(b, HIST_BUCKETS - 1)]);
+}
+
+/* MMIO primitives: callers hold mmio_lock and have checked bar0_mmio */
+static unsigned int mmio_read(struct board* b, int idx)
+{
+	bool timed = READ_ONCE(latency_stats) || trace_de2i_150_read_enabled();
+	unsigned int value;
+	u64 start = 0, ns;
+
+	if (timed)
+		start = ktime_get_ns();
+
+	value = ioread32(b->bar0_mmio + periph_offset[idx]);
+	b->stats.reads++;
+
+	if (timed) {
+		ns = ktime_get_ns() - start;
+		hist_add(&b->hist_mmio_read, ns);
+		trace_de2i_150_read(b->minor, idx, value, ns);
+	}
+
+	return value;
+}
+
+static void mmio_write(struct board* b, int idx, unsigned int value)
+{
+	bool timed = READ_ONCE(latency_stats) || trace_de2i_150_write_enabled();
+	u64 start = 0, ns;
+
+	if (timed)
+		start = ktime_get_ns();
+
+	iowrite32(value, b->bar0_mmio + periph_offset[idx]);
+	b->stats.writes++;
+
+	if (timed) {
+		ns = ktime_get_ns() - start;
+		hist_add(&b->hist_mmio_write, ns);
+		trace_de2i_150_write(b->minor, idx, value, ns);
+	}
+}
+
+/* append one record to the event ring; mmio_lock held */
+static void ev_push(struct board* b, u64 now, unsigned int periph, unsigned int value)
+{
+	struct ihs_event* ev = &b->ev_ring[b->ev_head & (EV_RING_LEN - 1)];
+
+	ev->ktime_ns = now;
+	ev->periph = periph;
+	ev->value = value;
+
+	/* publish the record before the new head */
+	smp_store_release(&b->ev_head, b->ev_head + 1);
+}
+
+/*
+ * feed one raw sample to the debouncer: a bit takes its new level once the
+ * raw bit stayed there for debounce_us. Returns whether a level changed;
+ * mmio_lock held.
+ */
+static bool debounce_locked(struct board* b, int idx, unsigned int raw, u64 now)
+{
+	u64 window = (u64)READ_ONCE(debounce_us) * NSEC_PER_USEC;
+	unsigned long moved, settled;
+	int bit;
+
+	raw &= BIT(IHS_INPUT_BITS) - 1;
+	if (!b->db_primed[idx]) {
+		b->db_primed[idx] = true;
+		b->db_raw[idx] = raw;
+		b->edges.level[idx] = raw;
+		return false;
+	}
+
+	moved = raw ^ b->db_raw[idx];
+	for_each_set_bit(bit, &moved, IHS_INPUT_BITS)
+		b->db_since[idx][bit] = now;
+	b->db_raw[idx] = raw;
+
+	settled = 0;
+	moved = raw ^ b->edges.level[idx];
+	for_each_set_bit(bit, &moved, IHS_INPUT_BITS) {
+		if (now - b->db_since[idx][bit] < window)
+			continue;
+		if (raw & BIT(bit))
+			b->edges.rise[idx][bit]++;
+		else
+			b->edges.fall[idx][bit]++;
+		settled |= BIT(bit);
+	}
+
+	b->edges.level[idx] ^= settled;
+	return settled != 0;
+}
+
+/* read one input, queueing an event if it changed; mmio_lock held */
+static bool input_sample_locked(struct board* b, int idx, u64 now)
+{
+	unsigned int value = mmio_read(b, idx);
+	bool edge = debounce_locked(b, idx, value, now);
+
+	b->input_stamp[idx] = now;
+	if (value == b->input_state[idx])
+		return edge;
+
+	b->input_state[idx] = value;
+	ev_push(b, now, idx, value);
+	return true;
+}
+
+/* tell pollers the inputs changed; mmio_lock held */
+static void input_changed_locked(struct board* b)
+{
+	b->input_seq++;
+	wake_up_interruptible(&b->input_wq);
+}
+
+/* read both inputs, waking pollers if they changed; mmio_lock held */
+static void sample_locked(struct board* b)
+{
+	u64 now = ktime_get_ns();
+	bool changed;
+
+	changed = input_sample_locked(b, PERIPH_SWITCHES, now);
+	changed |= input_sample_locked(b, PERIPH_PBUTTONS, now);
+
+	if (changed)
+		input_changed_locked(b);
+}
+
+/*
+ * register load/store used by every file operation; mmio_lock held. Inputs
+ * sampled less than read_cache_us ago are served from input_state, outputs
+ * already holding the value are not written again (see elide_writes).
+ */
+static unsigned int periph_load_locked(struct board* b, int idx)
+{
+	u64 window = (u64)READ_ONCE(read_cache_us) * NSEC_PER_USEC;
+	u64 now;
+
+	/* a posted write not drained yet is what the register will hold */
+	if (!periph_is_input(idx)) {
+		if (b->posted_mask & BIT(idx))
+			return b->posted[idx];
+		return mmio_read(b, idx);
+	}
+
+	now = ktime_get_ns();
+	if (window && now - b->input_stamp[idx] < window) {
+		b->stats.reads_cached++;
+		return b->input_state[idx];
+	}
+
+	if (input_sample_locked(b, idx, now))
+		input_changed_locked(b);
+	return b->input_state[idx];
+}
+
+static void periph_store_locked(struct board* b, int idx, unsigned int value)
+{
+	/* while user space has the registers mapped the shadow can't be trusted */
+	if (READ_ONCE(elide_writes) && b->shadow_valid[idx] && b->shadow[idx] == value &&
+	    atomic_read(&b->mmio_mappings) == 0) {
+		b->stats.writes_elided++;
+		return;
+	}
+
+	mmio_write(b, idx, value);
+	b->shadow[idx] = value;
+	b->shadow_valid[idx] = true;
+}
+
+/* forget the shadow registers, e.g. after user space stored to them; mmio_lock held */
+static void shadow_invalidate_locked(struct board* b)
+{
+	memset(b->shadow_valid, 0, sizeof(b->shadow_valid));
+	memset(b->input_stamp, 0, sizeof(b->input_stamp));
+}
+
+/* single register access, serialized against other openers and removal */
+static int periph_read(struct board* b, int idx, unsigned int* value)
+{
+	unsigned long flags;
+	int ret = -ENODEV;
+
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	if (b->bar0_mmio != NULL) {
+		*value = periph_load_locked(b, idx);
+		ret = 0;
+	}
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	return ret;
+}
+
+/* an input read with read(), which re-arms poll() like RD_INPUTS does */
+static int input_read(struct file_ctx* ctx, int idx, unsigned int* value)
+{
+	struct board* b = ctx->b;
+	unsigned long flags;
+	int ret = -ENODEV;
+
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	if (b->bar0_mmio != NULL) {
+		*value = periph_load_locked(b, idx);
+		ctx->seen_seq = b->input_seq;
+		ret = 0;
+	}
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	return ret;
+}
+
+/*
+ * O_NONBLOCK writers only record the value, coalescing with any value still
+ * pending for the register, and wr_work does the MMIO later; mmio_lock held
+ */
+static void periph_post_locked(struct board* b, int idx, unsigned int value)
+{
+	if (b->posted_mask & BIT(idx))
+		b->stats.writes_coalesced++;
+	else
+		b->stats.writes_posted++;
+
+	b->posted[idx] = value;
+	b->posted_mask |= BIT(idx);
+	queue_work(wr_wq, &b->wr_work);
+}
+
+/* store an output from a file, posted when the file is O_NONBLOCK; mmio_lock held */
+static void periph_put_locked(struct board* b, struct file* filp, int idx, unsigned int value)
+{
+	if (filp->f_flags & O_NONBLOCK) {
+		periph_post_locked(b, idx, value);
+		return;
+	}
+
+	/* a blocking write must not be overtaken by an older posted one */
+	b->posted_mask &= ~BIT(idx);
+	periph_store_locked(b, idx, value);
+}
+
+static int periph_put(struct board* b, struct file* filp, int idx, unsigned int value)
+{
+	unsigned long flags;
+	int ret = -ENODEV;
+
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	if (b->bar0_mmio != NULL) {
+		periph_put_locked(b, filp, idx, value);
+		ret = 0;
+	}
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	return ret;
+}
+
+static void drain_posted(struct work_struct* work)
+{
+	struct board* b = container_of(work, struct board, wr_work);
+	unsigned long flags;
+	int idx;
+
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	if (b->bar0_mmio != NULL)
+		for_each_set_bit(idx, &b->posted_mask, PERIPH_COUNT)
+			periph_store_locked(b, idx, b->posted[idx]);
+	b->posted_mask = 0;
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+}
+
+/* show one frame of the animation on the outputs; mmio_lock held */
+static void anim_store_locked(struct board* b, int idx, unsigned int value)
+{
+	/* a posted value older than the frame must not land after it */
+	b->posted_mask &= ~BIT(idx);
+	periph_store_locked(b, idx, value);
+}
+
+static enum hrtimer_restart play_frame(struct hrtimer* timer)
+{
+	struct board* b = container_of(timer, struct board, anim_timer);
+	enum hrtimer_restart ret = HRTIMER_RESTART;
+	struct ihs_frame* f;
+	unsigned long flags;
+
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	f = &b->anim[b->anim_pos];
+	if (b->bar0_mmio != NULL) {
+		anim_store_locked(b, PERIPH_RED_LEDS, f->ledr);
+		anim_store_locked(b, PERIPH_GREEN_LEDS, f->ledg);
+		anim_store_locked(b, PERIPH_L_DISPLAY, f->hex_l);
+		anim_store_locked(b, PERIPH_R_DISPLAY, f->hex_r);
+	}
+	hrtimer_forward_now(timer, us_to_ktime(f->delay_us));
+
+	if (++b->anim_pos == b->anim_count) {
+		if (b->anim_loop)
+			b->anim_pos = 0;
+		else
+			ret = HRTIMER_NORESTART;
+	}
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	return ret;
+}
+
+static enum hrtimer_restart sample_inputs(struct hrtimer* timer)
+{
+	struct board* b = container_of(timer, struct board, sample_timer);
+	unsigned int rate = READ_ONCE(sample_rate_hz);
+	unsigned long flags;
+
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	if (b->bar0_mmio != NULL)
+		sample_locked(b);
+	if (rate == 0)
+		b->sampler_on = false;
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	/* a rate of 0 written at run time stops the sampler until next open */
+	if (rate == 0)
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, ns_to_ktime(NSEC_PER_SEC / rate));
+	return HRTIMER_RESTART;
+}
+
+/* called with sampler_mutex held */
+static void sampler_start(struct board* b)
+{
+	unsigned int rate = READ_ONCE(sample_rate_hz);
+	unsigned long flags;
+
+	if (rate == 0)
+		return;
+
+	/* prime the state so RD_INPUTS never returns a stale sample */
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	if (b->bar0_mmio != NULL)
+		sample_locked(b);
+	b->sampler_on = true;
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	hrtimer_start(&b->sample_timer, ns_to_ktime(NSEC_PER_SEC / rate), HRTIMER_MODE_REL);
+}
+
+/* called with sampler_mutex held */
+static void sampler_stop(struct board* b)
+{
+	unsigned long flags;
+
+	hrtimer_cancel(&b->sample_timer);
+
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	b->sampler_on = false;
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+}
+
+/* validate an offset-addressed access against the PIO windows and BAR0 */
+static int pio_check(struct board* b, loff_t off, size_t count)
+{
+	if ((off | count) & 3)
+		return -EINVAL;
+	if (off < PIO_BASE || off > PIO_END || count > PIO_END - off)
+		return -EINVAL;
+	if (off + count > READ_ONCE(b->bar0_len))
+		return -EINVAL;
+	return 0;
+}
+
+static ssize_t pio_read(struct board* b, char __user* buf, size_t count, loff_t* f_pos)
 {
+	unsigned int words[PIO_WORD(PIO_END)];
+	loff_t off = *f_pos;
+	size_t i, n = count / 4;
+	unsigned long flags;
+	int ret, idx;
+
+	if ((ret = pio_check(b, off, count)) < 0)
+		return ret;
+
+	/*
+	 * the buffer is sampled under one lock hold; preadv() comes here once
+	 * per iovec segment, so only each segment is one consistent sample
+	 */
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	if (b->bar0_mmio == NULL) {
+		spin_unlock_irqrestore(&b->mmio_lock, flags);
+		return -ENODEV;
+	}
+	for (i = 0; i < n; i++) {
+		idx = periph_at(off + 4 * i);
+		words[i] = (idx < 0) ? 0 : periph_load_locked(b, idx);
+	}
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	if (copy_to_user(buf, words, count))
+		return -EFAULT;
+
+	*f_pos += count;
+	return count;
+}
+
+static ssize_t pio_write(struct board* b, struct file* filp, const char __user* buf, size_t count, loff_t* f_pos)
+{
+	unsigned int words[PIO_WORD(PIO_END)];
+	loff_t off = *f_pos;
+	size_t i, n = count / 4;
+	unsigned long flags;
+	int ret, idx;
+
+	if ((ret = pio_check(b, off, count)) < 0)
+		return ret;
+
+	if (copy_from_user(words, buf, count))
+		return -EFAULT;
+
+	/*
+	 * a buffer is never interleaved with another writer's; pwritev() comes
+	 * here once per iovec segment, each taking the lock on its own
+	 */
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	if (b->bar0_mmio == NULL) {
+		spin_unlock_irqrestore(&b->mmio_lock, flags);
+		return -ENODEV;
+	}
+	for (i = 0; i < n; i++) {
+		idx = periph_at(off + 4 * i);
+		if (idx >= 0 && !periph_is_input(idx))
+			periph_put_locked(b, filp, idx, words[i]);
+	}
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	*f_pos += count;
+	return count;
+}
+
+/* drain the event ring into buf; ev_lock held */
+static ssize_t ev_read_locked(struct file_ctx* ctx, char __user* buf, size_t max)
+{
+	struct board* b = ctx->b;
+	struct ihs_event batch[EV_BATCH];
+	unsigned long head, tail, first;
+	size_t n, done = 0;
+
+	while (done < max) {
+		head = smp_load_acquire(&b->ev_head);
+		tail = ctx->ev_tail;
+		if (head == tail)
+			break;
+
+		/*
+		 * the slot of record head - EV_RING_LEN is the one the producer
+		 * fills next, so only the last EV_RING_LEN - 1 records are safe
+		 */
+		n = 0;
+		if (head - tail >= EV_RING_LEN) {
+			/* the producer lapped this reader: report, then skip ahead */
+			batch[n].ktime_ns = ktime_get_ns();
+			batch[n].periph = EV_OVERFLOW;
+			batch[n].value = head - tail - (EV_RING_LEN - 1);
+			n++;
+			tail = head - (EV_RING_LEN - 1);
+		}
+
+		first = tail;
+		while (n < EV_BATCH && n < max - done && tail != head)
+			batch[n++] = b->ev_ring[tail++ & (EV_RING_LEN - 1)];
+
+		/* retry if the producer started overwriting what was just copied */
+		smp_rmb();
+		if (READ_ONCE(b->ev_head) - first >= EV_RING_LEN)
+			continue;
+
+		if (copy_to_user(buf + done * sizeof(*batch), batch, n * sizeof(*batch)))
+			return done ? done * sizeof(*batch) : -EFAULT;
+
+		WRITE_ONCE(ctx->ev_tail, tail);
+		done += n;
+	}
+
+	return done * sizeof(struct ihs_event);
+}
+
+/* a record is waiting for this file, or none will ever come */
+static bool ev_ready(struct file_ctx* ctx)
+{
+	return READ_ONCE(ctx->b->ev_head) != READ_ONCE(ctx->ev_tail) ||
+	       READ_ONCE(ctx->b->bar0_mmio) == NULL;
+}
+
+static ssize_t ev_read(struct file* filp, struct file_ctx* ctx, char __user* buf, size_t count)
+{
+	struct board* b = ctx->b;
+	size_t max = count / sizeof(struct ihs_event);
+	ssize_t retval;
+
+	if (max == 0)
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&ctx->ev_lock))
+		return -ERESTARTSYS;
+
+	while (smp_load_acquire(&b->ev_head) == ctx->ev_tail) {
+		mutex_unlock(&ctx->ev_lock);
+		/* records queued before removal are still returned */
+		if (READ_ONCE(b->bar0_mmio) == NULL)
+			return -ENODEV;
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(b->input_wq, ev_ready(ctx)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&ctx->ev_lock))
+			return -ERESTARTSYS;
+	}
+
+	retval = ev_read_locked(ctx, buf, max);
+	mutex_unlock(&ctx->ev_lock);
+
+	return retval;
+}
+
+static ssize_t do_read(struct file* filp, char __user* buf, size_t count, loff_t* f_pos, int* idx)
+{
+	struct file_ctx* ctx = filp->private_data;
 	ssize_t retval = 0;
 	int to_cpy = 0;
-	static unsigned int temp_read = 0;
+	unsigned int temp_read = 0;
+	int ret;
 
-	/* check if the read_pointer pointer is set */
-	if (read_pointer == NULL) {
-		printk("my_driver: trying to read to a device region not set yet\n");
-		return -ECANCELED;
-	}
+	/* a non-zero offset addresses BAR0 directly (pread/preadv) */
+	if (*f_pos != 0)
+		return pio_read(ctx->b, buf, count, f_pos);
+
+	/* input change records selected with RD_EVENTS */
+	if (ctx->ev_mode)
+		return ev_read(filp, ctx, buf, count);
 
 	/* read from the device */
-	temp_read = ioread32(read_pointer);
-	printk("my_driver: red 0x%X from the %s\n", temp_read, peripheral[rd_name_idx]);
+	*idx = ctx->rd_idx;
+	if (periph_is_input(ctx->rd_idx))
+		ret = input_read(ctx, ctx->rd_idx, &temp_read);
+	else
+		ret = periph_read(ctx->b, ctx->rd_idx, &temp_read);
+	if (ret < 0) {
+		pr_debug("my_driver: trying to read from a device not present\n");
+		return -ENODEV;
+	}
+	pr_debug("my_driver: red 0x%X from the %s\n", temp_read, peripheral[ctx->rd_idx]);
 
 	/* get amount of bytes to copy to user */
 	to_cpy = (count <= sizeof(temp_read)) ? count : sizeof(temp_read);
@@ -205,17 +1067,16 @@ static ssize_t my_read(struct file* filp, char __user* buf, size_t count, loff_t
 	return retval;
 }
 
-static ssize_t my_write(struct file* filp, const char __user* buf, size_t count, loff_t* f_pos)
+static ssize_t do_write(struct file* filp, const char __user* buf, size_t count, loff_t* f_pos, int* idx)
 {
+	struct file_ctx* ctx = filp->private_data;
 	ssize_t retval = 0;
 	int to_cpy = 0;
-	static unsigned int temp_write = 0;
+	unsigned int temp_write = 0;
 
-	/* check if the write_pointer pointer is set */
-	if (write_pointer == NULL) {
-		printk("my_driver: trying to write to a device region not set yet\n");
-		return -ECANCELED;
-	}
+	/* a non-zero offset addresses BAR0 directly (pwrite/pwritev) */
+	if (*f_pos != 0)
+		return pio_write(ctx->b, filp, buf, count, f_pos);
 
 	/* get amount of bytes to copy from user */
 	to_cpy = (count <= sizeof(temp_write)) ? count : sizeof(temp_write);
@@ -224,52 +1085,531 @@ static ssize_t my_write(struct file* filp, const char __user* buf, size_t count,
 	retval = to_cpy - copy_from_user(&temp_write, buf, to_cpy);
 
 	/* send to device */
-	iowrite32(temp_write, write_pointer);
-	printk("my_driver: wrote 0x%X to the %s\n", temp_write, peripheral[wr_name_idx]);
+	*idx = ctx->wr_idx;
+	if (periph_put(ctx->b, filp, ctx->wr_idx, temp_write) < 0) {
+		pr_debug("my_driver: trying to write to a device not present\n");
+		return -ENODEV;
+	}
+	pr_debug("my_driver: wrote 0x%X to the %s\n", temp_write, peripheral[ctx->wr_idx]);
 
 	return retval;
 }
 
-static long int my_ioctl(struct file*, unsigned int cmd, unsigned long arg)
+static long int my_ioctl_reg(struct board* b, struct file* filp, unsigned int cmd, unsigned long arg, int* idx)
 {
-	printk("my_driver: entrei aqui");
+	struct ihs_reg reg;
+	int ret;
+
+	if (copy_from_user(&reg, (void __user*)arg, sizeof(reg)))
+		return -EFAULT;
+
+	if (reg.periph >= PERIPH_COUNT)
+		return -EINVAL;
+	*idx = reg.periph;
+
+	if (cmd == WR_REG) {
+		/* input PIOs have no data register to write */
+		if (periph_is_input(reg.periph))
+			return -EINVAL;
+		return periph_put(b, filp, reg.periph, reg.value);
+	}
+
+	/* output PIOs read back their data register */
+	if ((ret = periph_read(b, reg.periph, &reg.value)) < 0)
+		return ret;
+	if (copy_to_user((void __user*)arg, &reg, sizeof(reg)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static long int my_ioctl_inputs(struct file_ctx* ctx, unsigned long arg)
+{
+	struct board* b = ctx->b;
+	struct ihs_inputs in;
+	unsigned long flags;
+
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	if (b->bar0_mmio == NULL) {
+		spin_unlock_irqrestore(&b->mmio_lock, flags);
+		return -ENODEV;
+	}
+	/* without the sampler the registers are read right now */
+	if (b->sampler_on) {
+		in.switches = b->input_state[PERIPH_SWITCHES];
+		in.buttons = b->input_state[PERIPH_PBUTTONS];
+	} else {
+		in.switches = periph_load_locked(b, PERIPH_SWITCHES);
+		in.buttons = periph_load_locked(b, PERIPH_PBUTTONS);
+	}
+	ctx->seen_seq = b->input_seq;
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	if (copy_to_user((void __user*)arg, &in, sizeof(in)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static long int my_ioctl_anim(struct board* b, unsigned long arg)
+{
+	struct ihs_frame *frames = NULL, *old;
+	struct ihs_anim anim;
+	unsigned long flags;
+	unsigned int i;
+
+	if (copy_from_user(&anim, (void __user*)arg, sizeof(anim)))
+		return -EFAULT;
+
+	if (anim.count > ANIM_MAX_FRAMES || (anim.flags & ~ANIM_LOOP))
+		return -EINVAL;
+
+	if (anim.count) {
+		frames = memdup_user(u64_to_user_ptr(anim.frames), anim.count * sizeof(*frames));
+		if (IS_ERR(frames))
+			return PTR_ERR(frames);
+		/* the timer runs in hard irq context, keep it from hogging the CPU */
+		for (i = 0; i < anim.count; i++) {
+			if (frames[i].delay_us < ANIM_MIN_DELAY_US) {
+				kfree(frames);
+				return -EINVAL;
+			}
+		}
+	}
+
+	mutex_lock(&b->anim_mutex);
+	hrtimer_cancel(&b->anim_timer);
+
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	if (b->bar0_mmio == NULL) {
+		spin_unlock_irqrestore(&b->mmio_lock, flags);
+		mutex_unlock(&b->anim_mutex);
+		kfree(frames);
+		return -ENODEV;
+	}
+	old = b->anim;
+	b->anim = frames;
+	b->anim_count = anim.count;
+	b->anim_pos = 0;
+	b->anim_loop = anim.flags & ANIM_LOOP;
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	/* the first frame is shown right away */
+	if (frames != NULL)
+		hrtimer_start(&b->anim_timer, 0, HRTIMER_MODE_REL);
+	mutex_unlock(&b->anim_mutex);
+
+	kfree(old);
+	return 0;
+}
+
+/* wait until every write posted so far reached the board */
+static int my_sync(struct board* b)
+{
+	flush_work(&b->wr_work);
+	return READ_ONCE(b->bar0_mmio) ? 0 : -ENODEV;
+}
+
+static int my_fsync(struct file* filp, loff_t start, loff_t end, int datasync)
+{
+	struct file_ctx* ctx = filp->private_data;
+
+	return my_sync(ctx->b);
+}
+
+static long int my_ioctl_edges(struct file_ctx* ctx, unsigned long arg)
+{
+	struct board* b = ctx->b;
+	struct ihs_edges now, out;
+	unsigned long flags;
+	int i, bit;
+
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	if (b->bar0_mmio == NULL) {
+		spin_unlock_irqrestore(&b->mmio_lock, flags);
+		return -ENODEV;
+	}
+	/* without the sampler nothing is debounced in between, take a sample */
+	if (!b->sampler_on)
+		sample_locked(b);
+	now = b->edges;
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	/* counters only grow, this file reports what happened since its last call */
+	for (i = 0; i < 2; i++) {
+		out.level[i] = now.level[i];
+		for (bit = 0; bit < IHS_INPUT_BITS; bit++) {
+			out.rise[i][bit] = now.rise[i][bit] - ctx->edges_seen.rise[i][bit];
+			out.fall[i][bit] = now.fall[i][bit] - ctx->edges_seen.fall[i][bit];
+		}
+	}
+
+	if (copy_to_user((void __user*)arg, &out, sizeof(out)))
+		return -EFAULT;
+
+	ctx->edges_seen = now;
+	return 0;
+}
+
+static long int do_ioctl(struct file* filp, unsigned int cmd, unsigned long arg, int* idx)
+{
+	struct file_ctx* ctx = filp->private_data;
+	int sel;
+
+	/* the selection only affects this open file */
 	switch(cmd){
 	case RD_SWITCHES:
-		read_pointer = bar0_mmio + 0xC020;
-		rd_name_idx = IDX_SWITCH;
+		ctx->rd_idx = sel = PERIPH_SWITCHES;
+		ctx->ev_mode = false;
 		break;
 	case RD_PBUTTONS:
-		read_pointer = bar0_mmio + 0xC0A0;
-		rd_name_idx = IDX_PBUTTONS;
+		ctx->rd_idx = sel = PERIPH_PBUTTONS;
+		ctx->ev_mode = false;
 		break;
+	case RD_EVENTS:
+		/* the stream starts with the next change */
+		mutex_lock(&ctx->ev_lock);
+		ctx->ev_tail = smp_load_acquire(&ctx->b->ev_head);
+		ctx->ev_mode = true;
+		mutex_unlock(&ctx->ev_lock);
+		pr_debug("my_driver: ioctl selected the event stream\n");
+		return 0;
 	case WR_L_DISPLAY:
-		write_pointer = bar0_mmio + 0xC040;
-		wr_name_idx = IDX_DISPLAYL;
+		ctx->wr_idx = sel = PERIPH_L_DISPLAY;
 		break;
 	case WR_R_DISPLAY:
-		write_pointer = bar0_mmio + 0xC000;
-		wr_name_idx = IDX_DISPLAYR;
+		ctx->wr_idx = sel = PERIPH_R_DISPLAY;
 		break;
 	case WR_RED_LEDS:
-		write_pointer = bar0_mmio + 0xC080;
-		wr_name_idx = IDX_DISPLAYR;
+		ctx->wr_idx = sel = PERIPH_RED_LEDS;
 		break;
 	case WR_GREEN_LEDS:
-		write_pointer = bar0_mmio + 0xC060;
-		wr_name_idx = IDX_DISPLAYR;
+		ctx->wr_idx = sel = PERIPH_GREEN_LEDS;
 		break;
+	case WR_REG:
+	case RD_REG:
+		/* value-carrying commands do the MMIO access in this same call */
+		return my_ioctl_reg(ctx->b, filp, cmd, arg, idx);
+	case RD_INPUTS:
+		return my_ioctl_inputs(ctx, arg);
+	case RD_EDGES:
+		return my_ioctl_edges(ctx, arg);
+	case WR_ANIM:
+		return my_ioctl_anim(ctx->b, arg);
+	case WR_SYNC:
+		return my_sync(ctx->b);
 	default:
-		printk("my_driver: unknown ioctl command: 0x%X\n", cmd);
+		pr_debug("my_driver: unknown ioctl command: 0x%X\n", cmd);
+		return -ENOTTY;
+	}
+	pr_debug("my_driver: ioctl selected the %s\n", peripheral[sel]);
+	trace_de2i_150_select(ctx->b->minor, cmd, sel);
+	*idx = sel;
+	return 0;
+}
+
+/* account one syscall in the debugfs statistics */
+static void dbg_account(struct board* b, enum dbg_op op, int idx, long ret, size_t bytes, u64 start)
+{
+	struct periph_dbg* d = &b->dbg_periph[idx];
+
+	atomic_long_inc(&d->calls[op]);
+	if (ret < 0)
+		atomic_long_inc(&d->errors);
+	else
+		atomic_long_add(bytes, &d->bytes);
+
+	if (start)
+		hist_add(&b->hist_call[op], ktime_get_ns() - start);
+}
+
+static ssize_t my_read(struct file* filp, char __user* buf, size_t count, loff_t* f_pos)
+{
+	struct file_ctx* ctx = filp->private_data;
+	u64 start = READ_ONCE(latency_stats) ? ktime_get_ns() : 0;
+	int idx = DBG_MULTI;
+	ssize_t ret;
+
+	ret = do_read(filp, buf, count, f_pos, &idx);
+	dbg_account(ctx->b, OP_READ, idx, ret, ret, start);
+
+	return ret;
+}
+
+static ssize_t my_write(struct file* filp, const char __user* buf, size_t count, loff_t* f_pos)
+{
+	struct file_ctx* ctx = filp->private_data;
+	u64 start = READ_ONCE(latency_stats) ? ktime_get_ns() : 0;
+	int idx = DBG_MULTI;
+	ssize_t ret;
+
+	ret = do_write(filp, buf, count, f_pos, &idx);
+	dbg_account(ctx->b, OP_WRITE, idx, ret, ret, start);
+
+	return ret;
+}
+
+static long int my_ioctl(struct file* filp, unsigned int cmd, unsigned long arg)
+{
+	struct file_ctx* ctx = filp->private_data;
+	u64 start = READ_ONCE(latency_stats) ? ktime_get_ns() : 0;
+	int idx = DBG_MULTI;
+	long int ret;
+
+	ret = do_ioctl(filp, cmd, arg, &idx);
+	dbg_account(ctx->b, OP_IOCTL, idx, ret, _IOC_SIZE(cmd), start);
+
+	return ret;
+}
+
+/* debugfs files */
+
+static int stats_show(struct seq_file* m, void* unused)
+{
+	struct board* b = m->private;
+	struct periph_dbg* d;
+	int i;
+
+	seq_printf(m, "%-12s %10s %10s %10s %12s %8s\n",
+		   "peripheral", "ioctl", "read", "write", "bytes", "errors");
+	for (i = 0; i <= PERIPH_COUNT; i++) {
+		d = &b->dbg_periph[i];
+		seq_printf(m, "%-12s %10ld %10ld %10ld %12ld %8ld\n",
+			   (i < PERIPH_COUNT) ? peripheral[i] : "multi",
+			   atomic_long_read(&d->calls[OP_IOCTL]),
+			   atomic_long_read(&d->calls[OP_READ]),
+			   atomic_long_read(&d->calls[OP_WRITE]),
+			   atomic_long_read(&d->bytes),
+			   atomic_long_read(&d->errors));
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+/* one "<bucket lower bound in ns> <count>" line per non-empty bucket */
+static int hist_show(struct seq_file* m, void* unused)
+{
+	struct lat_hist* hist = m->private;
+	long n;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		n = atomic_long_read(&hist->bucket[i]);
+		if (n)
+			seq_printf(m, "%llu %ld\n", 1ULL << i, n);
 	}
 	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(hist);
+
+static void hist_reset(struct lat_hist* hist)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		atomic_long_set(&hist->bucket[i], 0);
+}
+
+/* any write to "reset" zeroes every counter and histogram of the board */
+static ssize_t reset_write(struct file* filp, const char __user* buf, size_t count, loff_t* f_pos)
+{
+	struct board* b = filp->private_data;
+	unsigned long flags;
+	int i, op;
+
+	for (i = 0; i <= PERIPH_COUNT; i++) {
+		for (op = 0; op < OP_COUNT; op++)
+			atomic_long_set(&b->dbg_periph[i].calls[op], 0);
+		atomic_long_set(&b->dbg_periph[i].bytes, 0);
+		atomic_long_set(&b->dbg_periph[i].errors, 0);
+	}
+	hist_reset(&b->hist_mmio_read);
+	hist_reset(&b->hist_mmio_write);
+	for (op = 0; op < OP_COUNT; op++)
+		hist_reset(&b->hist_call[op]);
+
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	memset(&b->stats, 0, sizeof(b->stats));
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	return count;
+}
+
+static const struct file_operations reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = reset_write,
+};
+
+static void dbg_init(struct board* b)
+{
+	b->dbg_dir = debugfs_create_dir(b->name, NULL);
+	debugfs_create_file("stats", 0444, b->dbg_dir, b, &stats_fops);
+	debugfs_create_file("mmio_read_ns", 0444, b->dbg_dir, &b->hist_mmio_read, &hist_fops);
+	debugfs_create_file("mmio_write_ns", 0444, b->dbg_dir, &b->hist_mmio_write, &hist_fops);
+	debugfs_create_file("ioctl_ns", 0444, b->dbg_dir, &b->hist_call[OP_IOCTL], &hist_fops);
+	debugfs_create_file("read_ns", 0444, b->dbg_dir, &b->hist_call[OP_READ], &hist_fops);
+	debugfs_create_file("write_ns", 0444, b->dbg_dir, &b->hist_call[OP_WRITE], &hist_fops);
+	debugfs_create_file("reset", 0200, b->dbg_dir, b, &reset_fops);
+}
+
+static __poll_t my_poll(struct file* filp, poll_table* wait)
+{
+	struct file_ctx* ctx = filp->private_data;
+	struct board* b = ctx->b;
+	__poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+	poll_wait(filp, &b->input_wq, wait);
+
+	if (READ_ONCE(b->bar0_mmio) == NULL)
+		return EPOLLHUP | EPOLLERR;
+
+	/* readable once the sampler saw a change this file has not fetched */
+	if (ctx->ev_mode) {
+		if (smp_load_acquire(&b->ev_head) != READ_ONCE(ctx->ev_tail))
+			mask |= EPOLLIN | EPOLLRDNORM;
+	} else if (READ_ONCE(b->input_seq) != ctx->seen_seq) {
+		mask |= EPOLLIN | EPOLLRDNORM;
+	}
+
+	return mask;
+}
+
+static void mmio_vm_open(struct vm_area_struct* vma)
+{
+	struct board* b = vma->vm_private_data;
+	unsigned long flags;
+
+	kref_get(&b->ref);
+
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	atomic_inc(&b->mmio_mappings);
+	shadow_invalidate_locked(b);
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+}
 
-static int __init my_pci_probe(struct pci_dev *dev, const struct pci_device_id *id)
+static void mmio_vm_close(struct vm_area_struct* vma)
+{
+	struct board* b = vma->vm_private_data;
+	unsigned long flags;
+
+	/* user stores went around the shadow registers */
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	atomic_dec(&b->mmio_mappings);
+	shadow_invalidate_locked(b);
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	kref_put(&b->ref, board_release);
+}
+
+/* the PIO page is inserted on first access, and no longer once the board is gone */
+static vm_fault_t mmio_vm_fault(struct vm_fault* vmf)
+{
+	struct vm_area_struct* vma = vmf->vma;
+	struct board* b = vma->vm_private_data;
+	vm_fault_t ret = VM_FAULT_SIGBUS;
+
+	down_read(&b->map_sem);
+	if (b->bar0_mmio != NULL)
+		ret = vmf_insert_pfn(vma, vmf->address, (b->bar0_start + PIO_BASE) >> PAGE_SHIFT);
+	up_read(&b->map_sem);
+
+	return ret;
+}
+
+static const struct vm_operations_struct mmio_vm_ops = {
+	.open = mmio_vm_open,
+	.close = mmio_vm_close,
+	.fault = mmio_vm_fault,
+};
+
+static int my_mmap(struct file* filp, struct vm_area_struct* vma)
+{
+	struct file_ctx* ctx = filp->private_data;
+	struct board* b = ctx->b;
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (READ_ONCE(b->bar0_mmio) == NULL)
+		return -ENODEV;
+
+	/* raw register access bypasses every check done by read/write/ioctl */
+	if (!capable(CAP_SYS_RAWIO))
+		return -EPERM;
+
+	/* only the page holding the PIO windows can be mapped, at PIO_BASE */
+	if (vma->vm_pgoff != (PIO_BASE >> PAGE_SHIFT) || size > PAGE_SIZE)
+		return -EINVAL;
+	if (PIO_BASE + size > b->bar0_len)
+		return -EINVAL;
+
+	/* registers can't be copied on write */
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	/* uncached: every user load/store must become one PCIe transaction */
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	vm_flags_set(vma, VM_IO | VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP);
+
+	/* populated by mmio_vm_fault(), so removal can revoke it */
+	vma->vm_ops = &mmio_vm_ops;
+	vma->vm_private_data = b;
+	mmio_vm_open(vma);
+	return 0;
+}
+
+/* allocate the state of a board and reserve it a minor; boards_lock held */
+static struct board* board_alloc(void)
+{
+	struct board* b;
+	int minor;
+
+	for (minor = 0; minor < MAX_BOARDS; minor++)
+		if (boards[minor] == NULL)
+			break;
+	if (minor == MAX_BOARDS)
+		return ERR_PTR(-ENOSPC);
+
+	/* the event ring makes this too big for kzalloc on a fragmented system */
+	b = kvzalloc(sizeof(*b), GFP_KERNEL);
+	if (b == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	kref_init(&b->ref);
+	b->minor = minor;
+	if (minor == 0)
+		snprintf(b->name, sizeof(b->name), "%s", FILE_NAME);
+	else
+		snprintf(b->name, sizeof(b->name), "%s-%d", FILE_NAME, minor);
+
+	spin_lock_init(&b->mmio_lock);
+	init_waitqueue_head(&b->input_wq);
+	mutex_init(&b->sampler_mutex);
+	atomic_set(&b->mmio_mappings, 0);
+	address_space_init_once(&b->mapping);
+	init_rwsem(&b->map_sem);
+	INIT_WORK(&b->wr_work, drain_posted);
+
+	/* prepare the input sampler, armed on first open */
+	hrtimer_init(&b->sample_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	b->sample_timer.function = sample_inputs;
+
+	/* and the output animation, armed by WR_ANIM */
+	mutex_init(&b->anim_mutex);
+	hrtimer_init(&b->anim_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	b->anim_timer.function = play_frame;
+
+	return b;
+}
+
+static int my_pci_probe(struct pci_dev *dev, const struct pci_device_id *id)
 {
 	unsigned short vendor, device;
 	unsigned char rev;
 	unsigned int bar_value;
 	unsigned long bar_len;
+	struct board* b;
+	dev_t devt;
+	int ret;
 
 	/* enable the device */
 	if (pci_enable_device(dev) < 0) {
@@ -296,23 +1636,117 @@ static int __init my_pci_probe(struct pci_dev *dev, const struct pci_device_id *
 		return -EBUSY;
 	}
 
+	/* opens of this board's minor wait until it is fully set up */
+	mutex_lock(&boards_lock);
+
+	b = board_alloc();
+	if (IS_ERR(b)) {
+		printk("my_driver: no room for another board!\n");
+		ret = PTR_ERR(b);
+		goto AllocError;
+	}
+
 	/* map the BAR0 Physical address space to virtual space */
-	bar0_mmio = pci_iomap(dev, 0, bar_len);
+	b->bar0_mmio = pci_iomap(dev, 0, bar_len);
+	if (b->bar0_mmio == NULL) {
+		printk("my_driver: PCI Error - BAR0 could not be mapped!\n");
+		ret = -ENOMEM;
+		goto MapError;
+	}
+	b->bar0_len = bar_len;
+	b->bar0_start = pci_resource_start(dev, 0);
+
+	/* associate a cdev with a set of file operations */
+	b->cdev = cdev_alloc();
+	if (b->cdev == NULL) {
+		ret = -ENOMEM;
+		goto CdevError;
+	}
+	b->cdev->owner = THIS_MODULE;
+	b->cdev->ops = &fops;
+	devt = MKDEV(MAJOR(my_device_nbr), b->minor);
+
+	/* create the device node, the sysfs attributes find the board in drvdata */
+	if (IS_ERR(device_create_with_groups(my_class, &dev->dev, devt, b, stats_groups, "%s", b->name))) {
+		printk("my_driver: can not create device file!\n");
+		ret = -EAGAIN;
+		goto FileError;
+	}
+
+	/* now make the device live for the users to access */
+	if ((ret = cdev_add(b->cdev, devt, 1)) < 0) {
+		printk("my_driver: registering of device to kernel failed!\n");
+		goto AddError;
+	}
 
-	/* initialize a default peripheral read and write pointer */
-	write_pointer = bar0_mmio + 0xC000; //TODO: update offset
-	read_pointer  = bar0_mmio + 0xC080; //TODO: update offset
+	/* statistics at /sys/kernel/debug/<board name> */
+	dbg_init(b);
 
+	pci_set_drvdata(dev, b);
+	boards[b->minor] = b;
+	mutex_unlock(&boards_lock);
+
+	printk("my_driver: PCI device available as /dev/%s\n", b->name);
 	return 0;
+
+AddError:
+	device_destroy(my_class, devt);
+FileError:
+	kobject_put(&b->cdev->kobj);
+CdevError:
+	pci_iounmap(dev, b->bar0_mmio);
+MapError:
+	kvfree(b);
+AllocError:
+	mutex_unlock(&boards_lock);
+	pci_release_region(dev, 0);
+	pci_disable_device(dev);
+	return ret;
 }
 
-static void __exit my_pci_remove(struct pci_dev *dev)
+static void my_pci_remove(struct pci_dev *dev)
 {
-	read_pointer = NULL;
-	write_pointer = NULL;
+	struct board* b = pci_get_drvdata(dev);
+	dev_t devt = MKDEV(MAJOR(my_device_nbr), b->minor);
+	void __iomem* mmio;
+	unsigned long flags;
+
+	/* no new opens; open files keep the board until they are closed */
+	mutex_lock(&boards_lock);
+	boards[b->minor] = NULL;
+	mutex_unlock(&boards_lock);
+
+	debugfs_remove_recursive(b->dbg_dir);
+	cdev_del(b->cdev);
+	device_destroy(my_class, devt);
+
+	/* no MMIO can be in flight once the mapping is withdrawn */
+	down_write(&b->map_sem);
+	spin_lock_irqsave(&b->mmio_lock, flags);
+	mmio = b->bar0_mmio;
+	b->bar0_mmio = NULL;
+	b->bar0_len = 0;
+	b->bar0_start = 0;
+	shadow_invalidate_locked(b);
+	spin_unlock_irqrestore(&b->mmio_lock, flags);
+
+	/* nor from user space: mapped processes get SIGBUS from now on */
+	unmap_mapping_range(&b->mapping, 0, 0, 1);
+	up_write(&b->map_sem);
+
+	/* posted writes that did not make it are dropped with the device */
+	cancel_work_sync(&b->wr_work);
+
+	/* so is the animation, WR_ANIM can no longer restart it */
+	mutex_lock(&b->anim_mutex);
+	hrtimer_cancel(&b->anim_timer);
+	mutex_unlock(&b->anim_mutex);
+
+	/* event readers and pollers learn the board is gone */
+	wake_up_interruptible(&b->input_wq);
 
 	/* remove the IO mapping done in probe func */
-	pci_iounmap(dev, bar0_mmio);
+	pci_iounmap(dev, mmio);
 
 	/* disable the PCI device */
 	pci_disable_device(dev);
@@ -320,7 +1754,8 @@ static void __exit my_pci_remove(struct pci_dev *dev)
 	/* unmark device PCI BAR0 as reserved */
 	pci_release_region(dev, 0);
 
-	printk("my_driver: PCI Device - Disabled and BAR0 Released");
+	printk("my_driver: PCI Device %s - Disabled and BAR0 Released\n", b->name);
+	kref_put(&b->ref, board_release);
 }
 
 module_init(my_init);
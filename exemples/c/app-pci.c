@@ -35,6 +35,13 @@ int main(int argc, char** argv)
 	retval = write(fd, &data, sizeof(data));
 	printf("wrote %d bytes\n", retval);
 	
+	/* both displays in one syscall: pwrite() a buffer laid out like BAR0 */
+	unsigned int frame[PIO_WORD(HEX_L_OFF) + 1] = {0};
+	frame[PIO_WORD(HEX_R_OFF)] = 0x79404040;
+	frame[PIO_WORD(HEX_L_OFF)] = 0x40404079;
+	retval = pwrite(fd, frame, sizeof(frame), PIO_BASE);
+	printf("wrote %d bytes frame\n", retval);
+
 	ioctl(fd, RD_PBUTTONS);
 	read(fd, &data, 1);
 	printf("new data: 0x%X\n", data);
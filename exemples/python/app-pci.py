@@ -3,13 +3,8 @@
 import os, sys
 from fcntl import ioctl
 
-# ioctl commands defined at the pci driver
-RD_SWITCHES   = 24929
-RD_PBUTTONS   = 24930
-WR_L_DISPLAY  = 24931
-WR_R_DISPLAY  = 24932
-WR_RED_LEDS   = 24933
-WR_GREEN_LEDS = 24934
+# ioctl commands defined at the pci driver, see 'make regmap'
+from fpga_regmap import RD_SWITCHES, RD_PBUTTONS, WR_L_DISPLAY, WR_R_DISPLAY
 
 def main():
     if len(sys.argv) < 2:
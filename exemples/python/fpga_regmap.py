@@ -0,0 +1,20 @@
+# FPGA register map and driver commands generated by gen_regmap.py from
+# pcihellocore.sopcinfo and ioctl_cmds.h, do not edit.
+
+# BAR0 offset of the data register of each PIO
+HEXPORT_BASE   = 0xC000
+INPORT_BASE    = 0xC020
+HEXPORT1_BASE  = 0xC040
+LEDG_BASE      = 0xC060
+LEDR_BASE      = 0xC080
+BUTTON_BASE    = 0xC0A0
+
+# ioctl commands without argument, _IO(type, nr) = type << 8 | nr
+RD_SWITCHES    = 0x6161
+RD_PBUTTONS    = 0x6162
+WR_L_DISPLAY   = 0x6163
+WR_R_DISPLAY   = 0x6164
+WR_RED_LEDS    = 0x6165
+WR_GREEN_LEDS  = 0x6166
+RD_EVENTS      = 0x616A
+WR_SYNC        = 0x616B
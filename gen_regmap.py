@@ -0,0 +1,148 @@
+#!/usr/bin/python3
+
+# Generates the register map of the FPGA design from its Platform Designer
+# description (.sopcinfo): the BAR0 offset, width and direction of every PIO.
+#
+#   gen_regmap.py <design.sopcinfo> <out.h>                    C/C++ header
+#   gen_regmap.py <design.sopcinfo> <out.py> <ioctl_cmds.h>    python module
+
+import os, re, sys
+import xml.etree.ElementTree as ET
+
+PIO_KIND = "altera_avalon_pio"
+BAR_INTERFACE = "bar0"
+
+def parse_pios(path):
+    root = ET.parse(path).getroot()
+
+    # width and direction are module parameters
+    pios = {}
+    for mod in root.findall("module"):
+        if mod.get("kind") != PIO_KIND:
+            continue
+        params = {p.get("name"): p.findtext("value") for p in mod.findall("parameter")}
+        pios[mod.get("name")] = {
+            "width": int(params["width"]),
+            "input": params["direction"] == "Input",
+        }
+
+    # offsets are the slaves seen by the PCIe BAR0 master
+    for iface in root.iter("interface"):
+        if iface.get("name") != BAR_INTERFACE:
+            continue
+        for block in iface.findall("memoryBlock"):
+            name = block.findtext("moduleName")
+            if name in pios:
+                pios[name]["base"] = int(block.findtext("baseAddress"))
+
+    missing = [n for n in pios if "base" not in pios[n]]
+    if not pios or missing:
+        sys.exit("%s: no BAR0 address for PIO(s) %s" % (path, ", ".join(missing) or "at all"))
+
+    return sorted(pios.items(), key=lambda item: item[1]["base"])
+
+def emit_header(pios, source):
+    first = pios[0][1]["base"]
+    end = pios[-1][1]["base"] + 4
+    out = []
+
+    out.append("/*")
+    out.append(" * FPGA register map generated by gen_regmap.py from")
+    out.append(" * %s, do not edit." % source)
+    out.append(" * Plain macros for C and the kernel, a constexpr map for C++.")
+    out.append(" */")
+    out.append("")
+    out.append("#ifndef __FPGA_REGMAP_H__")
+    out.append("#define __FPGA_REGMAP_H__")
+    out.append("")
+    out.append("/* BAR0 offset of the data register, width in bits and direction of each PIO */")
+    out.append("")
+    for name, pio in pios:
+        n = "FPGA_" + name.upper()
+        out.append("#define %-22s 0x%04X" % (n + "_BASE", pio["base"]))
+        out.append("#define %-22s %d" % (n + "_WIDTH", pio["width"]))
+        out.append("#define %-22s %d" % (n + "_INPUT", pio["input"]))
+    out.append("")
+    out.append("/* first data register and end of the last one */")
+    out.append("")
+    out.append("#define %-22s 0x%04X" % ("FPGA_PIO_BASE", first))
+    out.append("#define %-22s 0x%04X" % ("FPGA_PIO_END", end))
+    out.append("")
+    out.append("#ifdef __cplusplus")
+    out.append("")
+    out.append("#include <stdint.h>")
+    out.append("")
+    out.append("namespace fpga {")
+    out.append("")
+    out.append("// One PIO data register. 'page' is the BAR0 page at FPGA_PIO_BASE mapped")
+    out.append("// with mmap(), so every access is one load or store at a fixed offset.")
+    out.append("template <uint32_t Offset, unsigned Width, bool Input>")
+    out.append("struct pio {")
+    out.append("    static constexpr uint32_t offset = Offset;")
+    out.append("    static constexpr unsigned width = Width;")
+    out.append("    static constexpr bool input = Input;")
+    out.append("    static constexpr uint32_t mask = (Width >= 32) ? 0xFFFFFFFFu : (1u << Width) - 1;")
+    out.append("    static constexpr uint32_t word = (Offset - FPGA_PIO_BASE) / 4;")
+    out.append("")
+    out.append("    static uint32_t read(volatile uint32_t* page) {")
+    out.append("        return page[word] & mask;")
+    out.append("    }")
+    out.append("")
+    out.append("    static void write(volatile uint32_t* page, uint32_t value) {")
+    out.append("        static_assert(!Input, \"input PIOs have no data register to write\");")
+    out.append("        page[word] = value;")
+    out.append("    }")
+    out.append("};")
+    out.append("")
+    for name, pio in pios:
+        n = "FPGA_" + name.upper()
+        out.append("using %-8s = pio<%s_BASE, %s_WIDTH, %s_INPUT>;" % (name, n, n, n))
+    out.append("")
+    out.append("} // namespace fpga")
+    out.append("")
+    out.append("#endif /* __cplusplus */")
+    out.append("")
+    out.append("#endif /* __FPGA_REGMAP_H__ */")
+    return "\n".join(out) + "\n"
+
+# legacy commands of the driver: #define NAME _IO('t', 'n')
+IO_CMD = re.compile(r"^#define\s+(\w+)\s+_IO\('(.)',\s*'(.)'\)", re.M)
+
+def emit_python(pios, source, ioctl_header):
+    with open(ioctl_header) as f:
+        cmds = IO_CMD.findall(f.read())
+
+    out = []
+    out.append("# FPGA register map and driver commands generated by gen_regmap.py from")
+    out.append("# %s and %s, do not edit." % (source, os.path.basename(ioctl_header)))
+    out.append("")
+    out.append("# BAR0 offset of the data register of each PIO")
+    for name, pio in pios:
+        out.append("%-14s = 0x%04X" % (name.upper() + "_BASE", pio["base"]))
+    out.append("")
+    out.append("# ioctl commands without argument, _IO(type, nr) = type << 8 | nr")
+    for name, t, nr in cmds:
+        out.append("%-14s = 0x%04X" % (name, ord(t) << 8 | ord(nr)))
+    return "\n".join(out) + "\n"
+
+def main():
+    if len(sys.argv) < 3:
+        print("Syntax: %s <design.sopcinfo> <out.h | out.py ioctl_cmds.h>" % sys.argv[0])
+        exit(1)
+
+    sopcinfo, target = sys.argv[1], sys.argv[2]
+    pios = parse_pios(sopcinfo)
+    source = os.path.basename(sopcinfo)
+
+    if target.endswith(".py"):
+        if len(sys.argv) < 4:
+            sys.exit("the python module also needs ioctl_cmds.h")
+        text = emit_python(pios, source, sys.argv[3])
+    else:
+        text = emit_header(pios, source)
+
+    with open(target, "w") as f:
+        f.write(text)
+
+if __name__ == '__main__':
+    main()
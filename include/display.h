@@ -18,4 +18,142 @@
 #define HEX_E 0xFFFFFF86
 #define HEX_F 0xFFFFFF8E
 
+#ifdef __cplusplus
+
+#include <stdint.h>
+
+namespace seg7 {
+
+// A display word packs four digits, one byte each with digit 0 (rightmost)
+// in the low byte. Bits 0-6 are segments a-g and bit 7 the decimal point,
+// all active low, so 0xFF is a blank digit. The HEX_* codes above are
+// single digits on an otherwise blank word.
+
+constexpr uint8_t BLANK = 0xFF;
+constexpr uint8_t MINUS = 0xBF;             // segment g
+constexpr uint8_t POINT = 0x80;             // clear these bits to light the point
+constexpr uint32_t BLANK_WORD = 0xFFFFFFFF;
+constexpr uint32_t OVERFLOW_WORD = 0xBFBFBFBF;  // "----", value doesn't fit
+
+constexpr uint8_t glyph(uint32_t code) {
+    return (uint8_t)(code & 0xFF);
+}
+
+constexpr uint8_t hex_digits[16] = {
+    glyph(HEX_0), glyph(HEX_1), glyph(HEX_2), glyph(HEX_3),
+    glyph(HEX_4), glyph(HEX_5), glyph(HEX_6), glyph(HEX_7),
+    glyph(HEX_8), glyph(HEX_9), glyph(HEX_A), glyph(HEX_B),
+    glyph(HEX_C), glyph(HEX_D), glyph(HEX_E), glyph(HEX_F)
+};
+
+// Glyph of a character: digits, the letters a 7-segment digit can show
+// (either case, drawn in whichever case reads better), '-', '_' and ' '.
+// Anything else is blank.
+constexpr uint8_t letter(char c) {
+    if (c >= '0' && c <= '9') return hex_digits[c - '0'];
+    if (c >= 'a' && c <= 'z') c = (char)(c - 'a' + 'A');
+    switch (c) {
+        case 'A': return glyph(HEX_A);
+        case 'B': return glyph(HEX_B);
+        case 'C': return glyph(HEX_C);
+        case 'D': return glyph(HEX_D);
+        case 'E': return glyph(HEX_E);
+        case 'F': return glyph(HEX_F);
+        case 'G': return 0xC2;
+        case 'H': return 0x89;
+        case 'I': return 0xCF;
+        case 'J': return 0xE1;
+        case 'L': return 0xC7;
+        case 'N': return 0xAB;
+        case 'O': return 0xA3;
+        case 'P': return 0x8C;
+        case 'R': return 0xAF;
+        case 'S': return glyph(HEX_5);
+        case 'T': return 0x87;
+        case 'U': return 0xC1;
+        case 'Y': return 0x91;
+        case '-': return MINUS;
+        case '_': return 0xF7;
+        default:  return BLANK;
+    }
+}
+
+// Four glyphs into a word, d3 leftmost
+constexpr uint32_t pack(uint8_t d3, uint8_t d2, uint8_t d1, uint8_t d0) {
+    return (uint32_t)d3 << 24 | (uint32_t)d2 << 16 | (uint32_t)d1 << 8 | d0;
+}
+
+// Up to four characters, left aligned
+constexpr uint32_t text(const char* s) {
+    uint32_t word = BLANK_WORD;
+    for (int i = 0; i < 4 && s[i]; i++) {
+        word &= ~(0xFFu << (24 - 8 * i));
+        word |= (uint32_t)letter(s[i]) << (24 - 8 * i);
+    }
+    return word;
+}
+
+// 0-9999 right aligned without leading zeros, computed digit by digit
+constexpr uint32_t encode_decimal(unsigned int value) {
+    if (value > 9999) return OVERFLOW_WORD;
+    uint32_t word = BLANK_WORD;
+    int pos = 0;
+    do {
+        word &= ~(0xFFu << (8 * pos));
+        word |= (uint32_t)hex_digits[value % 10] << (8 * pos);
+        value /= 10;
+        pos++;
+    } while (value);
+    return word;
+}
+
+// Every 0-9999 word, built by the compiler
+struct DecimalTable {
+    uint32_t word[10000];
+
+    constexpr DecimalTable() : word() {
+        for (unsigned int i = 0; i < 10000; i++) {
+            word[i] = encode_decimal(i);
+        }
+    }
+};
+
+inline constexpr DecimalTable decimal_table{};
+
+// Non-negative number, "----" past 9999: one table load
+constexpr uint32_t decimal(int value) {
+    return (value >= 0 && value <= 9999) ? decimal_table.word[value] : OVERFLOW_WORD;
+}
+
+// -999 to 9999, the minus sign right before the first digit
+constexpr uint32_t signed_decimal(int value) {
+    if (value >= 0) return decimal(value);
+    if (value < -999) return OVERFLOW_WORD;
+
+    uint32_t word = decimal_table.word[-value];
+    int sign = (-value >= 100) ? 3 : (-value >= 10) ? 2 : 1;
+    return (word & ~(0xFFu << (8 * sign))) | (uint32_t)MINUS << (8 * sign);
+}
+
+// Four hex digits, with leading zeros
+constexpr uint32_t hex(uint16_t value) {
+    return pack(hex_digits[value >> 12], hex_digits[(value >> 8) & 0xF],
+                hex_digits[(value >> 4) & 0xF], hex_digits[value & 0xF]);
+}
+
+// Light the decimal point of digit pos (0 is rightmost)
+constexpr uint32_t with_point(uint32_t word, int pos) {
+    return word & ~((uint32_t)POINT << (8 * pos));
+}
+
+static_assert(decimal(7) == HEX_7, "single digits match the HEX_* codes");
+static_assert(decimal(1024) == pack(glyph(HEX_1), glyph(HEX_0), glyph(HEX_2), glyph(HEX_4)), "");
+static_assert(signed_decimal(-42) == pack(BLANK, MINUS, glyph(HEX_4), glyph(HEX_2)), "");
+static_assert(hex(0xBEEF) == pack(glyph(HEX_B), glyph(HEX_E), glyph(HEX_E), glyph(HEX_F)), "");
+static_assert(text("Go") == pack(0xC2, 0xA3, BLANK, BLANK), "");
+
+} // namespace seg7
+
+#endif /* __cplusplus */
+
 #endif /* __DISPLAY_H__ */
@@ -0,0 +1,184 @@
+#ifndef __FPGA_DEVICE_H__
+#define __FPGA_DEVICE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "ioctl_cmds.h"
+
+// The two 7-segment display banks
+enum HexDisplay {
+    HEX_LEFT,
+    HEX_RIGHT
+};
+
+// Access to the board peripherals. The game only talks to this interface,
+// so the transport behind it (driver, mock, recorder) is picked at startup.
+// Every call returns 0 on success, -1 with errno set on failure.
+class FpgaDevice {
+public:
+    virtual ~FpgaDevice() {}
+
+    // Backend name, for the logs
+    virtual const char* name() const = 0;
+
+    // Typed accessors, built on writeReg()/readReg() unless a backend has
+    // a faster way to reach that one register
+    virtual int setRedLeds(uint32_t pattern)   { return writeReg(PERIPH_RED_LEDS, pattern); }
+    virtual int setGreenLeds(uint32_t pattern) { return writeReg(PERIPH_GREEN_LEDS, pattern); }
+    virtual int setHex(HexDisplay display, uint32_t segments) {
+        return writeReg(display == HEX_LEFT ? PERIPH_L_DISPLAY : PERIPH_R_DISPLAY, segments);
+    }
+    virtual int readSwitches(uint32_t* value)  { return readReg(PERIPH_SWITCHES, value); }
+    virtual int readButtons(uint32_t* value)   { return readReg(PERIPH_PBUTTONS, value); }
+
+    // One peripheral data register, indexed by enum ihs_peripheral
+    virtual int writeReg(unsigned int periph, uint32_t value) = 0;
+    virtual int readReg(unsigned int periph, uint32_t* value) = 0;
+
+    // Switches and buttons together, as one consistent sample if possible
+    virtual int readInputs(uint32_t* switches, uint32_t* buttons);
+
+    // Play LED/HEX frames on the device, count 0 stops; ENOTTY if unsupported
+    virtual int playAnimation(const struct ihs_frame* frames, unsigned int count, bool loop);
+
+    // Wait until every write issued so far reached the board
+    virtual int sync() { return 0; }
+
+    // File descriptor that polls readable once the inputs changed since the
+    // last readInputs(), -1 if the backend can't tell: the hardware thread
+    // would spin on one that stays readable
+    virtual int inputFd() const { return -1; }
+};
+
+// Driver backend: /dev/de2i-150 (or another node) through mmap or ioctl.
+// NULL with errno set if the device can't be opened.
+FpgaDevice* fpga_open_driver(const char* path);
+
+// In-process mock: keeps the registers in memory, no board needed
+class MockFpgaDevice : public FpgaDevice {
+public:
+    MockFpgaDevice();
+
+    const char* name() const { return "mock"; }
+    int writeReg(unsigned int periph, uint32_t value);
+    int readReg(unsigned int periph, uint32_t* value);
+
+    // Test hook: what the switches and buttons read next
+    void setInput(unsigned int periph, uint32_t value);
+
+    uint32_t regs[PERIPH_COUNT];
+    unsigned long writes;
+    unsigned long reads;
+};
+
+// Binary trace written by RecordingFpgaDevice and read by ReplayFpgaDevice:
+// the 8 byte magic, then one 16 byte record per access in host byte order.
+// An 'A' record is followed by its frames, each as FPGA_TRACE_FRAME_FIELDS
+// 'F' records in struct ihs_frame order (delay_us, ledr, ledg, hex_l, hex_r).
+#define FPGA_TRACE_MAGIC "FPGATRC2"
+#define FPGA_TRACE_FRAME_FIELDS 5
+
+typedef struct {
+    uint64_t ns;        // since the recording started
+    uint32_t value;     // value written or read, frame count for 'A'
+    uint8_t op;         // 'W' write, 'R' read, 'A' animation, 'F' frame field, 'S' sync
+    uint8_t periph;     // enum ihs_peripheral, loop flag for 'A', field index for 'F'
+    uint8_t err;        // errno of a failed access, 0 on success
+    uint8_t pad;
+} FpgaTraceRecord;
+
+// Wraps another device and appends every access to a binary trace
+class RecordingFpgaDevice : public FpgaDevice {
+public:
+    // Takes ownership of both the inner device and the log
+    RecordingFpgaDevice(FpgaDevice* inner, FILE* log);
+    ~RecordingFpgaDevice();
+
+    const char* name() const { return "recording"; }
+    int writeReg(unsigned int periph, uint32_t value);
+    int readReg(unsigned int periph, uint32_t* value);
+    int readInputs(uint32_t* switches, uint32_t* buttons);
+    int playAnimation(const struct ihs_frame* frames, unsigned int count, bool loop);
+    int sync();
+    int inputFd() const { return inner->inputFd(); }
+
+private:
+    void record(char op, unsigned int periph, uint32_t value, int ret);
+
+    FpgaDevice* inner;
+    FILE* log;
+    long long t0;
+};
+
+// Plays a trace back, independently of when the app happens to access the
+// device:
+//  - switches and buttons read what the recording read at the same time
+//    since the start, and inputFd() polls readable when that changes, so
+//    the app sees input changes with the recorded cadence
+//  - other reads return the recorded values in order (the last one once
+//    exhausted), like the self-test read back
+//  - writes are checked per register against the recorded sequence of
+//    values, with repeats of the same value collapsed on both sides, so
+//    neither the interleaving of registers nor how often an unchanged
+//    value was rewritten matters
+//  - animations are checked in order: frame count, loop flag and every
+//    field of every frame
+// The outputs are then checked exactly as far as they are a function of
+// the game state sequence: scores, state patterns and animations. The LEDs
+// showing the ball during play also depend on the keyboard, which is not
+// part of the trace, and match only if the game is played the same way.
+class ReplayFpgaDevice : public FpgaDevice {
+public:
+    ReplayFpgaDevice();
+    ~ReplayFpgaDevice();
+
+    // Load a trace, -1 with errno set if it can't be read or isn't one.
+    // Replay time starts here.
+    int load(const char* path);
+
+    const char* name() const { return "replay"; }
+    int writeReg(unsigned int periph, uint32_t value);
+    int readReg(unsigned int periph, uint32_t* value);
+    int playAnimation(const struct ihs_frame* frames, unsigned int count, bool loop);
+    int inputFd() const { return timer_fd; }
+
+    // Writes matching the trace, and the others
+    unsigned long matched;
+    unsigned long mismatched;
+
+private:
+    int check(std::vector<FpgaTraceRecord>& expected, size_t& pos,
+              unsigned int periph, uint32_t value);
+    int readInput(unsigned int periph, uint32_t* value);
+    void armInputTimer();
+
+    // An 'A' record and the fields of its frames
+    struct Animation {
+        FpgaTraceRecord rec;
+        std::vector<uint32_t> fields;
+    };
+
+    std::vector<FpgaTraceRecord> reads[PERIPH_COUNT];
+    std::vector<FpgaTraceRecord> writes[PERIPH_COUNT];
+    std::vector<Animation> anims;
+    size_t read_pos[PERIPH_COUNT];
+    size_t write_pos[PERIPH_COUNT];
+    size_t anim_pos;
+    uint32_t last_write[PERIPH_COUNT];  // last value written by the app
+    uint32_t written;                   // one bit per register in last_write
+    const char* path;
+    long long t0;                       // replay start, CLOCK_MONOTONIC ns
+    int timer_fd;                       // expires at the next input change
+};
+
+// Backend chosen by the environment:
+//   PONG_FPGA         "null" for the mock, "replay:<trace>" to play a
+//                     trace back, else the device node (default /dev/de2i-150)
+//   PONG_FPGA_RECORD  file to record a binary trace of every access to
+// NULL with errno set if the backend can't be opened.
+FpgaDevice* fpga_open_from_env();
+
+#endif /* __FPGA_DEVICE_H__ */
@@ -0,0 +1,39 @@
+#ifndef __FPGA_MMIO_H__
+#define __FPGA_MMIO_H__
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "ioctl_cmds.h"
+
+/*
+ * User space access to the PIO page of BAR0 mapped with mmap(). Every
+ * accessor is a single volatile load or store, i.e. one PCIe transaction
+ * and no syscall. Mapping requires CAP_SYS_RAWIO; unprivileged users keep
+ * the ioctl()/pread()/pwrite() interface.
+ */
+
+#define FPGA_MMIO_LEN 4096
+
+/* map the PIO page of an open /dev/de2i-150, NULL on failure */
+static inline volatile uint32_t* fpga_mmio_map(int fd)
+{
+	void* p = mmap(NULL, FPGA_MMIO_LEN, PROT_READ | PROT_WRITE,
+		       MAP_SHARED, fd, PIO_BASE);
+	return (p == MAP_FAILED) ? NULL : (volatile uint32_t*)p;
+}
+
+static inline void fpga_mmio_unmap(volatile uint32_t* regs)
+{
+	munmap((void*)regs, FPGA_MMIO_LEN);
+}
+
+/*
+ * data register of a PIO in the mapped page, by its name in the register
+ * map: FPGA_MMIO_REG(regs, LEDR) = value. The offset is a constant, so this
+ * is one load or store. C++ code uses the fpga::<pio>::read()/write() of
+ * fpga_regmap.h instead.
+ */
+#define FPGA_MMIO_REG(regs, pio) ((regs)[PIO_WORD(FPGA_##pio##_BASE)])
+
+#endif /* __FPGA_MMIO_H__ */
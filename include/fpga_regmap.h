@@ -0,0 +1,73 @@
+/*
+ * FPGA register map generated by gen_regmap.py from
+ * pcihellocore.sopcinfo, do not edit.
+ * Plain macros for C and the kernel, a constexpr map for C++.
+ */
+
+#ifndef __FPGA_REGMAP_H__
+#define __FPGA_REGMAP_H__
+
+/* BAR0 offset of the data register, width in bits and direction of each PIO */
+
+#define FPGA_HEXPORT_BASE      0xC000
+#define FPGA_HEXPORT_WIDTH     32
+#define FPGA_HEXPORT_INPUT     0
+#define FPGA_INPORT_BASE       0xC020
+#define FPGA_INPORT_WIDTH      16
+#define FPGA_INPORT_INPUT      1
+#define FPGA_HEXPORT1_BASE     0xC040
+#define FPGA_HEXPORT1_WIDTH    32
+#define FPGA_HEXPORT1_INPUT    0
+#define FPGA_LEDG_BASE         0xC060
+#define FPGA_LEDG_WIDTH        32
+#define FPGA_LEDG_INPUT        0
+#define FPGA_LEDR_BASE         0xC080
+#define FPGA_LEDR_WIDTH        32
+#define FPGA_LEDR_INPUT        0
+#define FPGA_BUTTON_BASE       0xC0A0
+#define FPGA_BUTTON_WIDTH      4
+#define FPGA_BUTTON_INPUT      1
+
+/* first data register and end of the last one */
+
+#define FPGA_PIO_BASE          0xC000
+#define FPGA_PIO_END           0xC0A4
+
+#ifdef __cplusplus
+
+#include <stdint.h>
+
+namespace fpga {
+
+// One PIO data register. 'page' is the BAR0 page at FPGA_PIO_BASE mapped
+// with mmap(), so every access is one load or store at a fixed offset.
+template <uint32_t Offset, unsigned Width, bool Input>
+struct pio {
+    static constexpr uint32_t offset = Offset;
+    static constexpr unsigned width = Width;
+    static constexpr bool input = Input;
+    static constexpr uint32_t mask = (Width >= 32) ? 0xFFFFFFFFu : (1u << Width) - 1;
+    static constexpr uint32_t word = (Offset - FPGA_PIO_BASE) / 4;
+
+    static uint32_t read(volatile uint32_t* page) {
+        return page[word] & mask;
+    }
+
+    static void write(volatile uint32_t* page, uint32_t value) {
+        static_assert(!Input, "input PIOs have no data register to write");
+        page[word] = value;
+    }
+};
+
+using hexport  = pio<FPGA_HEXPORT_BASE, FPGA_HEXPORT_WIDTH, FPGA_HEXPORT_INPUT>;
+using inport   = pio<FPGA_INPORT_BASE, FPGA_INPORT_WIDTH, FPGA_INPORT_INPUT>;
+using hexport1 = pio<FPGA_HEXPORT1_BASE, FPGA_HEXPORT1_WIDTH, FPGA_HEXPORT1_INPUT>;
+using ledg     = pio<FPGA_LEDG_BASE, FPGA_LEDG_WIDTH, FPGA_LEDG_INPUT>;
+using ledr     = pio<FPGA_LEDR_BASE, FPGA_LEDR_WIDTH, FPGA_LEDR_INPUT>;
+using button   = pio<FPGA_BUTTON_BASE, FPGA_BUTTON_WIDTH, FPGA_BUTTON_INPUT>;
+
+} // namespace fpga
+
+#endif /* __cplusplus */
+
+#endif /* __FPGA_REGMAP_H__ */
@@ -1,6 +1,10 @@
 #ifndef __IOCTL_CMDS_H__
 #define __IOCTL_CMDS_H__
 
+#include "fpga_regmap.h"
+
+/* legacy commands: select the peripheral used by the next read()/write() */
+
 #define RD_SWITCHES   _IO('a', 'a')
 #define RD_PBUTTONS   _IO('a', 'b')
 #define WR_L_DISPLAY  _IO('a', 'c')
@@ -8,4 +12,136 @@
 #define WR_RED_LEDS   _IO('a', 'e')
 #define WR_GREEN_LEDS _IO('a', 'f')
 
+/* peripherals addressed by the value-carrying commands */
+
+enum ihs_peripheral {
+	PERIPH_SWITCHES = 0,
+	PERIPH_PBUTTONS,
+	PERIPH_L_DISPLAY,
+	PERIPH_R_DISPLAY,
+	PERIPH_GREEN_LEDS,
+	PERIPH_RED_LEDS,
+	PERIPH_COUNT
+};
+
+/* argument of WR_REG and RD_REG: one register access in a single syscall */
+
+struct ihs_reg {
+	unsigned int periph;	/* enum ihs_peripheral */
+	unsigned int value;	/* value to write / value read back */
+};
+
+#define WR_REG        _IOW('a', 'g', struct ihs_reg)
+#define RD_REG        _IOWR('a', 'h', struct ihs_reg)
+
+/*
+ * argument of RD_INPUTS: both inputs as last sampled by the driver. poll()
+ * reports POLLIN once they changed since this file's previous RD_INPUTS, or
+ * read() of the switches or buttons selected with RD_SWITCHES/RD_PBUTTONS.
+ */
+
+struct ihs_inputs {
+	unsigned int switches;
+	unsigned int buttons;
+};
+
+#define RD_INPUTS     _IOR('a', 'i', struct ihs_inputs)
+
+/*
+ * RD_EVENTS switches read() on this file (offset 0) to a stream of input
+ * change records taken by the driver's sampler; RD_SWITCHES/RD_PBUTTONS
+ * switch it back. A read returns whole records, blocking unless O_NONBLOCK.
+ * Records overwritten before being read are reported by an EV_OVERFLOW
+ * record whose value is the number of records lost.
+ */
+
+#define EV_OVERFLOW   PERIPH_COUNT
+
+struct ihs_event {
+	unsigned long long ktime_ns;	/* CLOCK_MONOTONIC time of the sample */
+	unsigned int periph;		/* PERIPH_SWITCHES, PERIPH_PBUTTONS or EV_OVERFLOW */
+	unsigned int value;		/* new value, or records lost */
+};
+
+#define RD_EVENTS     _IO('a', 'j')
+
+/*
+ * argument of RD_EDGES: the debounced inputs and, per bit, the 0->1 (rise)
+ * and 1->0 (fall) transitions seen since this file's previous RD_EDGES. A
+ * bit only changes once its raw level held for the driver's debounce window,
+ * so contact bounce is not counted. The push buttons are active low: a
+ * press is a fall and a release a rise.
+ */
+
+#define IHS_INPUT_BITS 16
+
+struct ihs_edges {
+	unsigned int level[2];			/* indexed by PERIPH_SWITCHES/PERIPH_PBUTTONS */
+	unsigned int rise[2][IHS_INPUT_BITS];
+	unsigned int fall[2][IHS_INPUT_BITS];
+};
+
+#define RD_EDGES      _IOR('a', 'l', struct ihs_edges)
+
+/*
+ * WR_ANIM hands the driver a sequence of output frames that it plays from a
+ * timer, with no further syscalls: every frame is written to the four
+ * outputs and held for its delay_us. With ANIM_LOOP the sequence restarts
+ * after its last frame, otherwise it stops there leaving that frame shown.
+ * A new WR_ANIM replaces the running sequence, one with no frames just stops
+ * it. Other writes to the outputs last until the next frame is played.
+ */
+
+#define ANIM_MAX_FRAMES   256
+#define ANIM_MIN_DELAY_US 100
+#define ANIM_LOOP         0x1
+
+struct ihs_frame {
+	unsigned int delay_us;
+	unsigned int ledr;
+	unsigned int ledg;
+	unsigned int hex_l;
+	unsigned int hex_r;
+};
+
+struct ihs_anim {
+	unsigned int count;		/* frames, at most ANIM_MAX_FRAMES */
+	unsigned int flags;		/* ANIM_LOOP */
+	unsigned long long frames;	/* user address of 'count' struct ihs_frame */
+};
+
+#define WR_ANIM       _IOW('a', 'm', struct ihs_anim)
+
+/*
+ * writes on a file opened with O_NONBLOCK (write(), pwrite() and WR_REG) are
+ * queued per register, a newer value replacing one not yet written, and
+ * reach the board shortly after the call returns. WR_SYNC, like fsync(),
+ * waits until every write queued before it was performed.
+ */
+
+#define WR_SYNC       _IO('a', 'k')
+
+/*
+ * BAR0 offsets of the PIO data registers, for pread()/pwrite() and their
+ * vectored variants. Each PIO owns a PIO_STRIDE window; only the first word
+ * of a window is transferred, the others read as zero and ignore writes, so
+ * a buffer laid out like BAR0 moves several registers in one call, without
+ * another writer's registers in between. The vectored variants give that
+ * per iovec segment only, not across segments. Offset 0 keeps the legacy
+ * behaviour of the register selected with ioctl().
+ */
+
+#define PIO_BASE      FPGA_PIO_BASE
+#define PIO_STRIDE    0x20
+#define HEX_R_OFF     FPGA_HEXPORT_BASE
+#define SWITCHES_OFF  FPGA_INPORT_BASE
+#define HEX_L_OFF     FPGA_HEXPORT1_BASE
+#define LEDG_OFF      FPGA_LEDG_BASE
+#define LEDR_OFF      FPGA_LEDR_BASE
+#define PBUTTONS_OFF  FPGA_BUTTON_BASE
+#define PIO_END       FPGA_PIO_END
+
+/* index of the 32-bit word at BAR0 offset 'off' inside a PIO_BASE buffer */
+#define PIO_WORD(off) (((off) - PIO_BASE) / 4)
+
 #endif /* __IOCTL_CMDS_H__ */
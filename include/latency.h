@@ -0,0 +1,31 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdio.h>
+
+// Latency paths measured end to end, each one fed by a single thread
+enum LatencyPath {
+    LAT_KEY_TO_SCREEN,   // keyboard event -> SDL_RenderPresent() of the frame handling it
+    LAT_KEY_TO_BOARD,    // keyboard event -> LED/HEX write showing its state change
+    LAT_FRAME_TO_BOARD,  // snapshot published -> output write derived from it
+    LAT_BUTTON_TO_GAME,  // new switch/button reading -> game thread seeing it
+    LAT_RENDER,          // simulation done -> SDL_RenderPresent() returned
+    LAT_COUNT
+};
+
+// CLOCK_MONOTONIC in nanoseconds, the time base of every stamp
+long long latency_now_ns();
+
+// Account one sample of a path. Lock-free; histograms are log-linear with
+// 16 steps per power of two (about 6% resolution) plus the exact maximum.
+void latency_record(int path, long long ns);
+
+// Print count, p50, p99 and max of every path
+void latency_dump(FILE* out);
+
+// Make a signal (e.g. SIGUSR1) request a dump, picked up with
+// latency_dump_requested() by the thread that should print it
+void latency_dump_on_signal(int signo);
+bool latency_dump_requested();
+
+#endif /* __LATENCY_H__ */
@@ -4,6 +4,11 @@
 #include <SDL2/SDL.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <atomic>
+
+#include "ioctl_cmds.h"
+#include "fpga_device.h"
+#include "spsc_queue.h"
 
 // Game constants
 #define WINDOW_WIDTH 800
@@ -22,6 +27,10 @@ typedef enum {
     GAME_OVER
 } GameState;
 
+// GameData::hw_anim when the driver plays no LED animation
+#define HW_ANIM_NONE        -1
+#define HW_ANIM_UNSUPPORTED -2
+
 // Game objects
 typedef struct {
     float x, y;
@@ -33,6 +42,45 @@ typedef struct {
     int score;
 } Paddle;
 
+// What the hardware thread needs from a frame, published by the game thread
+typedef struct alignas(64) {
+    GameState state;
+    float ball_x, ball_y;
+    int score1, score2;
+    int winner;
+    uint32_t frame;                 // frame ID, for the latency stats
+    long long publish_ns;           // when it was published
+    long long state_key_ns;         // keyboard event behind the last state change
+} HwSnapshot;
+
+// Triple buffer of snapshots: the game thread fills buf[back] and swaps it
+// with middle, the hardware thread swaps front with middle when that one is
+// fresh. Neither side ever waits for the other.
+#define SNAP_FRESH 4u
+
+typedef struct {
+    HwSnapshot buf[3];
+    std::atomic<unsigned> middle;   // index of the latest snapshot, | SNAP_FRESH if unread
+    unsigned back;                  // game thread only
+    unsigned front;                 // hardware thread only
+} SnapshotBuffer;
+
+// Commands queued to the hardware thread
+enum {
+    HW_CMD_WRITE,       // write value to periph
+    HW_CMD_SELFTEST,    // write and read back test patterns on every output
+    HW_CMD_QUIT         // blank the board and stop the thread
+};
+
+typedef struct {
+    uint32_t seq;
+    uint16_t op;
+    uint16_t periph;
+    uint32_t value;
+} HwCommand;
+
+#define HW_QUEUE_LEN 256
+
 // Game data shared between threads
 typedef struct {
     GameState state;
@@ -40,10 +88,41 @@ typedef struct {
     Paddle player1, player2;
     int winner;
     
-    // Hardware state
-    uint32_t switches;
-    uint32_t buttons;
-    int fpga_fd;
+    // Latency stamps of the frame being built, game thread only
+    uint32_t frame;
+    long long input_ns;             // first keyboard event of the frame, 0 if none
+    long long state_key_ns;         // keyboard event behind the last state change
+    long long hw_inputs_seen;       // hw_inputs_ns of the last reading seen
+    
+    // Hardware state, owned by the hardware thread once it runs
+    SnapshotBuffer hw_snap;
+    std::atomic<uint64_t> hw_inputs;        // switches << 32 | buttons, last reading
+    std::atomic<long long> hw_inputs_ns;    // when hw_inputs last changed
+    uint32_t hw_frame_shown;        // last frame whose outputs were written
+    long long hw_key_shown;         // last state_key_ns whose outputs were written
+    FpgaDevice* fpga;               // NULL when running without hardware
+    int hw_anim;                    // GameState the driver animates the LEDs for, or HW_ANIM_*
+    uint32_t hw_out[PERIPH_COUNT];  // last value written to each output, by enum ihs_peripheral
+    uint32_t hw_out_valid;          // one bit per peripheral whose hw_out[] matches the board
+    unsigned long hw_writes;        // output writes issued
+    unsigned long hw_writes_elided; // output writes skipped, the register already held the value
+    std::atomic<bool> hw_follow;    // outputs follow the snapshots, off during the self-test
+
+    // Command queue to the hardware thread, the only one touching the device
+    SpscQueue<HwCommand, HW_QUEUE_LEN> hw_cmds;
+    uint32_t hw_cmd_seq;                    // game thread: last command queued
+    uint32_t hw_cmd_waited;                 // game thread: last command hw_wait()ed for
+    unsigned long hw_cmd_dropped;           // game thread: commands lost to a full queue
+    int hw_score_shown[2];                  // game thread: scores queued to the displays
+    uint32_t hw_anim_seen;                  // game thread: hw_anim_changes when they were queued
+    std::atomic<uint32_t> hw_anim_changes;  // LED animations started or stopped
+    std::atomic<uint32_t> hw_cmd_done;      // last command run
+    std::atomic<uint32_t> hw_cmd_failed;    // last command that failed
+    std::atomic<int> hw_cmd_errno;          // and why
+    int hw_wake_fd;                         // eventfd waking the hardware thread
+    pthread_t hw_thread;
+    pthread_mutex_t hw_done_lock;
+    pthread_cond_t hw_done_cond;            // signaled when hw_cmd_done moves
     
     // Synchronization
     pthread_mutex_t mutex;
@@ -54,7 +133,20 @@ typedef struct {
 void* hardware_thread(void* arg);
 int init_hardware(GameData* game);
 void cleanup_hardware(GameData* game);
-void update_leds(GameData* game);
+void update_leds(GameData* game, const HwSnapshot* snap);
 void update_displays(GameData* game);
+void publish_snapshot(GameData* game);
+
+// Queue a write to the hardware thread: no lock and no syscall. Returns its
+// sequence number, 0 with errno set if it was not queued.
+uint32_t hw_write(GameData* game, unsigned int periph, uint32_t value);
+
+static inline uint32_t hw_set_hex(GameData* game, HexDisplay display, uint32_t segments) {
+    return hw_write(game, display == HEX_LEFT ? PERIPH_L_DISPLAY : PERIPH_R_DISPLAY, segments);
+}
+
+// Wake the hardware thread and wait until command seq ran. -1 with errno
+// set if it, or any command queued since the previous wait, failed.
+int hw_wait(GameData* game, uint32_t seq);
 
 #endif /* __PONG_H__ */
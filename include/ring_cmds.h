@@ -0,0 +1,28 @@
+#ifndef __RING_CMDS_H__
+#define __RING_CMDS_H__
+
+/*
+ * commands of the ring buffer char device (driver/char/dummy.c). read() and
+ * write() copy through the ring like a pipe; for zero-copy exchange the
+ * ring is mmap()ed at offset 0 and producer and consumer move its indexes:
+ *
+ *	producer: RING_STATE, fill data[head % size] .. up to size - (head - tail)
+ *	          bytes, then RING_PRODUCE with the number of bytes filled
+ *	consumer: RING_STATE, use data[tail % size] .. up to head - tail bytes,
+ *	          then RING_CONSUME with the number of bytes used
+ *
+ * The region may wrap past the end of the mapping back to its start. Only
+ * one producer and one consumer may use the mapping at a time.
+ */
+
+struct ring_state {
+	unsigned long long head;	/* bytes ever written */
+	unsigned long long tail;	/* bytes ever read */
+	unsigned int size;		/* ring size, a power of two */
+};
+
+#define RING_STATE    _IOR('r', 'a', struct ring_state)
+#define RING_PRODUCE  _IO('r', 'b')	/* argument: bytes filled in the mapping */
+#define RING_CONSUME  _IO('r', 'c')	/* argument: bytes used from the mapping */
+
+#endif /* __RING_CMDS_H__ */
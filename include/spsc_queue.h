@@ -0,0 +1,52 @@
+#ifndef __SPSC_QUEUE_H__
+#define __SPSC_QUEUE_H__
+
+#include <atomic>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. head and tail count the items ever pushed and popped, so
+// head - tail is the fill level and the slot is the count modulo N, like
+// the ring of driver/char/dummy.c. push() and pop() never block nor make a
+// syscall; each touches the other side's index once.
+template <typename T, unsigned N>
+class SpscQueue {
+    static_assert(N != 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // Producer: false if the queue is full
+    bool push(const T& item) {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        slots[h & (N - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: false if the queue is empty
+    bool pop(T* item) {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == t) {
+            return false;
+        }
+        *item = slots[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side, a hint only
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    // Each index on its own cache line, written by one side only
+    alignas(64) std::atomic<unsigned> head;     // written by the producer
+    alignas(64) std::atomic<unsigned> tail;     // written by the consumer
+    alignas(64) T slots[N];
+};
+
+#endif /* __SPSC_QUEUE_H__ */
@@ -0,0 +1,539 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "ioctl_cmds.h"
+#include "fpga_mmio.h"
+#include "fpga_device.h"
+
+int FpgaDevice::readInputs(uint32_t* switches, uint32_t* buttons) {
+    if (readSwitches(switches) < 0) return -1;
+    return readButtons(buttons);
+}
+
+int FpgaDevice::playAnimation(const struct ihs_frame* frames, unsigned int count, bool loop) {
+    errno = ENOTTY;
+    return -1;
+}
+
+// Driver backend: plain loads and stores when the PIO page can be mapped,
+// one ioctl per access otherwise
+class DriverFpgaDevice : public FpgaDevice {
+public:
+    DriverFpgaDevice(int fd) : fd(fd) {
+        regs = fpga_mmio_map(fd);
+        if (regs) {
+            printf("FPGA registers mapped, using direct MMIO\n");
+        } else {
+            printf("FPGA registers not mapped (%s), using ioctl\n", strerror(errno));
+        }
+
+        // poll() only means "inputs changed" on a driver with RD_INPUTS,
+        // which is also what re-arms it
+        struct ihs_inputs in;
+        notify = (ioctl(fd, RD_INPUTS, &in) == 0);
+    }
+
+    ~DriverFpgaDevice() {
+        if (regs) fpga_mmio_unmap(regs);
+        close(fd);
+    }
+
+    const char* name() const { return regs ? "driver-mmio" : "driver-ioctl"; }
+
+    // Each register through its constexpr type: a store or load at a fixed
+    // offset of the mapped page
+    int setRedLeds(uint32_t pattern)   { return store<fpga::ledr>(PERIPH_RED_LEDS, pattern); }
+    int setGreenLeds(uint32_t pattern) { return store<fpga::ledg>(PERIPH_GREEN_LEDS, pattern); }
+    int setHex(HexDisplay display, uint32_t segments) {
+        if (display == HEX_LEFT) return store<fpga::hexport1>(PERIPH_L_DISPLAY, segments);
+        return store<fpga::hexport>(PERIPH_R_DISPLAY, segments);
+    }
+    int readSwitches(uint32_t* value)  { return load<fpga::inport>(PERIPH_SWITCHES, value); }
+    int readButtons(uint32_t* value)   { return load<fpga::button>(PERIPH_PBUTTONS, value); }
+
+    int writeReg(unsigned int periph, uint32_t value) {
+        switch (periph) {
+            case PERIPH_RED_LEDS:   return setRedLeds(value);
+            case PERIPH_GREEN_LEDS: return setGreenLeds(value);
+            case PERIPH_L_DISPLAY:  return setHex(HEX_LEFT, value);
+            case PERIPH_R_DISPLAY:  return setHex(HEX_RIGHT, value);
+        }
+        // Let the driver refuse the rest
+        return ioctlWrite(periph, value);
+    }
+
+    int readReg(unsigned int periph, uint32_t* value) {
+        switch (periph) {
+            case PERIPH_SWITCHES:   return readSwitches(value);
+            case PERIPH_PBUTTONS:   return readButtons(value);
+            case PERIPH_L_DISPLAY:  return load<fpga::hexport1>(periph, value);
+            case PERIPH_R_DISPLAY:  return load<fpga::hexport>(periph, value);
+            case PERIPH_GREEN_LEDS: return load<fpga::ledg>(periph, value);
+            case PERIPH_RED_LEDS:   return load<fpga::ledr>(periph, value);
+        }
+        return ioctlRead(periph, value);
+    }
+
+    // Both inputs as sampled by the driver, in one syscall; this also
+    // re-arms the POLLIN notification on inputFd()
+    int readInputs(uint32_t* switches, uint32_t* buttons) {
+        struct ihs_inputs in;
+        if (ioctl(fd, RD_INPUTS, &in) == 0) {
+            *switches = in.switches;
+            *buttons = in.buttons;
+            return 0;
+        }
+        // Nothing re-arms the notification any more, it would stay readable
+        notify = false;
+        return FpgaDevice::readInputs(switches, buttons);
+    }
+
+    int playAnimation(const struct ihs_frame* frames, unsigned int count, bool loop) {
+        struct ihs_anim anim = {};
+        anim.count = count;
+        anim.flags = loop ? ANIM_LOOP : 0;
+        anim.frames = (uintptr_t)frames;
+        return ioctl(fd, WR_ANIM, &anim);
+    }
+
+    int sync() { return ioctl(fd, WR_SYNC); }
+
+    int inputFd() const { return notify ? fd : -1; }
+
+private:
+    template <typename Pio>
+    int store(unsigned int periph, uint32_t value) {
+        if (regs) {
+            Pio::write(regs, value);
+            return 0;
+        }
+        return ioctlWrite(periph, value);
+    }
+
+    template <typename Pio>
+    int load(unsigned int periph, uint32_t* value) {
+        if (regs) {
+            *value = Pio::read(regs);
+            return 0;
+        }
+        return ioctlRead(periph, value);
+    }
+
+    int ioctlWrite(unsigned int periph, uint32_t value) {
+        struct ihs_reg reg = { periph, value };
+        return ioctl(fd, WR_REG, &reg);
+    }
+
+    int ioctlRead(unsigned int periph, uint32_t* value) {
+        struct ihs_reg reg = { periph, 0 };
+        if (ioctl(fd, RD_REG, &reg) < 0) {
+            return -1;
+        }
+        *value = reg.value;
+        return 0;
+    }
+
+    int fd;
+    volatile uint32_t* regs;    // mmap()ed PIO page, NULL if not mapped
+    bool notify;                // inputFd() polls readable on input changes
+};
+
+FpgaDevice* fpga_open_driver(const char* path) {
+    // O_NONBLOCK makes the driver queue register writes instead of holding
+    // the caller for the bus transaction
+    int fd = open(path, O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        return NULL;
+    }
+    printf("FPGA device %s opened successfully (fd=%d)\n", path, fd);
+    return new DriverFpgaDevice(fd);
+}
+
+MockFpgaDevice::MockFpgaDevice() : writes(0), reads(0) {
+    memset(regs, 0, sizeof(regs));
+    // Displays blank, the segments are active low
+    regs[PERIPH_L_DISPLAY] = 0xFFFFFFFF;
+    regs[PERIPH_R_DISPLAY] = 0xFFFFFFFF;
+}
+
+int MockFpgaDevice::writeReg(unsigned int periph, uint32_t value) {
+    // Same rule as the driver: inputs have no data register to write
+    if (periph >= PERIPH_COUNT || periph == PERIPH_SWITCHES || periph == PERIPH_PBUTTONS) {
+        errno = EINVAL;
+        return -1;
+    }
+    regs[periph] = value;
+    writes++;
+    return 0;
+}
+
+int MockFpgaDevice::readReg(unsigned int periph, uint32_t* value) {
+    if (periph >= PERIPH_COUNT) {
+        errno = EINVAL;
+        return -1;
+    }
+    *value = regs[periph];
+    reads++;
+    return 0;
+}
+
+void MockFpgaDevice::setInput(unsigned int periph, uint32_t value) {
+    if (periph == PERIPH_SWITCHES || periph == PERIPH_PBUTTONS) {
+        regs[periph] = value;
+    }
+}
+
+static long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+RecordingFpgaDevice::RecordingFpgaDevice(FpgaDevice* inner, FILE* log)
+    : inner(inner), log(log), t0(monotonic_ns()) {
+    fwrite(FPGA_TRACE_MAGIC, 1, 8, log);
+}
+
+RecordingFpgaDevice::~RecordingFpgaDevice() {
+    fclose(log);
+    delete inner;
+}
+
+void RecordingFpgaDevice::record(char op, unsigned int periph, uint32_t value, int ret) {
+    FpgaTraceRecord rec = {};
+    rec.ns = monotonic_ns() - t0;
+    rec.value = value;
+    rec.op = op;
+    rec.periph = periph;
+    rec.err = (ret < 0) ? errno : 0;
+
+    // Callers look at errno after a failed access
+    int err = errno;
+    fwrite(&rec, sizeof(rec), 1, log);
+    errno = err;
+}
+
+int RecordingFpgaDevice::writeReg(unsigned int periph, uint32_t value) {
+    int ret = inner->writeReg(periph, value);
+    record('W', periph, value, ret);
+    return ret;
+}
+
+int RecordingFpgaDevice::readReg(unsigned int periph, uint32_t* value) {
+    int ret = inner->readReg(periph, value);
+    record('R', periph, ret == 0 ? *value : 0, ret);
+    return ret;
+}
+
+int RecordingFpgaDevice::readInputs(uint32_t* switches, uint32_t* buttons) {
+    int ret = inner->readInputs(switches, buttons);
+    record('R', PERIPH_SWITCHES, ret == 0 ? *switches : 0, ret);
+    record('R', PERIPH_PBUTTONS, ret == 0 ? *buttons : 0, ret);
+    return ret;
+}
+
+// The fields of the frames in trace order, FPGA_TRACE_FRAME_FIELDS per frame
+static std::vector<uint32_t> frame_fields(const struct ihs_frame* frames, unsigned int count) {
+    std::vector<uint32_t> fields;
+
+    for (unsigned int i = 0; i < count; i++) {
+        fields.push_back(frames[i].delay_us);
+        fields.push_back(frames[i].ledr);
+        fields.push_back(frames[i].ledg);
+        fields.push_back(frames[i].hex_l);
+        fields.push_back(frames[i].hex_r);
+    }
+    return fields;
+}
+
+static const char* const frame_field_names[FPGA_TRACE_FRAME_FIELDS] = {
+    "delay_us", "ledr", "ledg", "hex_l", "hex_r"
+};
+
+// Animations are logged as 'A' with the frame count in the value field
+// and the loop flag in place of the peripheral, then one 'F' per field
+int RecordingFpgaDevice::playAnimation(const struct ihs_frame* frames, unsigned int count, bool loop) {
+    int ret = inner->playAnimation(frames, count, loop);
+    int err = errno;
+    record('A', loop, count, ret);
+
+    std::vector<uint32_t> fields = frame_fields(frames, count);
+    for (size_t i = 0; i < fields.size(); i++) {
+        record('F', i % FPGA_TRACE_FRAME_FIELDS, fields[i], 0);
+    }
+    errno = err;
+    return ret;
+}
+
+int RecordingFpgaDevice::sync() {
+    int ret = inner->sync();
+    record('S', 0, 0, ret);
+    return ret;
+}
+
+ReplayFpgaDevice::ReplayFpgaDevice()
+    : matched(0), mismatched(0), anim_pos(0), written(0), path(""), t0(0), timer_fd(-1) {
+    memset(read_pos, 0, sizeof(read_pos));
+    memset(write_pos, 0, sizeof(write_pos));
+}
+
+ReplayFpgaDevice::~ReplayFpgaDevice() {
+    if (timer_fd >= 0) close(timer_fd);
+    if (!*path) return;     // nothing was loaded
+
+    unsigned long missing = 0;
+    for (unsigned int i = 0; i < PERIPH_COUNT; i++) {
+        missing += writes[i].size() - write_pos[i];
+    }
+    missing += anims.size() - anim_pos;
+    printf("Replay of %s: %lu writes matched, %lu mismatched, %lu never made: %s\n",
+           path, matched, mismatched, missing,
+           (mismatched || missing) ? "FAIL" : "PASS");
+}
+
+static bool is_input(unsigned int periph) {
+    return periph == PERIPH_SWITCHES || periph == PERIPH_PBUTTONS;
+}
+
+int ReplayFpgaDevice::load(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return -1;
+
+    char magic[8];
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+        memcmp(magic, FPGA_TRACE_MAGIC, sizeof(magic)) != 0) {
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+
+    FpgaTraceRecord rec;
+    unsigned long count = 0;
+    while (fread(&rec, sizeof(rec), 1, f) == 1) {
+        count++;
+        if (rec.op == 'A') {
+            anims.push_back(Animation{rec, std::vector<uint32_t>()});
+        } else if (rec.op == 'F') {
+            if (!anims.empty()) anims.back().fields.push_back(rec.value);
+        } else if (rec.periph >= PERIPH_COUNT) {
+            continue;
+        } else if (rec.op == 'W') {
+            // A register rewritten with the value it holds is no change
+            std::vector<FpgaTraceRecord>& w = writes[rec.periph];
+            if (w.empty() || w.back().value != rec.value || w.back().err || rec.err) {
+                w.push_back(rec);
+            }
+        } else if (rec.op == 'R') {
+            reads[rec.periph].push_back(rec);
+        }
+    }
+    fclose(f);
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) return -1;
+
+    this->path = path;
+    t0 = monotonic_ns();
+    armInputTimer();
+    printf("Replaying %lu FPGA accesses from %s\n", count, path);
+    return 0;
+}
+
+// Compare a write with the next expected one of its register, and return
+// what the recorded one returned
+int ReplayFpgaDevice::check(std::vector<FpgaTraceRecord>& expected, size_t& pos,
+                            unsigned int periph, uint32_t value) {
+    if (pos >= expected.size()) {
+        if (mismatched++ < 10) {
+            printf("Replay: register %u: 0x%08X written past the end of the trace\n", periph, value);
+        }
+        return 0;
+    }
+
+    const FpgaTraceRecord& rec = expected[pos++];
+    if (rec.value == value) {
+        matched++;
+    } else if (mismatched++ < 10) {
+        printf("Replay: register %u #%zu: 0x%08X written, trace has 0x%08X at %.3f ms\n",
+               periph, pos, value, rec.value, rec.ns / 1e6);
+    }
+    if (rec.err) {
+        errno = rec.err;
+        return -1;
+    }
+    return 0;
+}
+
+int ReplayFpgaDevice::writeReg(unsigned int periph, uint32_t value) {
+    if (periph >= PERIPH_COUNT) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Same collapsing as load(): only changes are compared
+    if ((written & (1u << periph)) && last_write[periph] == value) {
+        return 0;
+    }
+    int ret = check(writes[periph], write_pos[periph], periph, value);
+    if (ret == 0) {
+        last_write[periph] = value;
+        written |= 1u << periph;
+    } else {
+        written &= ~(1u << periph);
+    }
+    return ret;
+}
+
+// Arm timer_fd for the first recorded input change after the current
+// replay time, disarm it if there is none
+void ReplayFpgaDevice::armInputTimer() {
+    long long next = -1;
+
+    for (unsigned int periph = 0; periph < PERIPH_COUNT; periph++) {
+        if (!is_input(periph) || reads[periph].empty()) continue;
+
+        const std::vector<FpgaTraceRecord>& r = reads[periph];
+        uint32_t now_value = r[read_pos[periph]].value;
+        for (size_t i = read_pos[periph] + 1; i < r.size(); i++) {
+            if (r[i].value != now_value) {
+                if (next < 0 || (long long)r[i].ns < next) next = r[i].ns;
+                break;
+            }
+        }
+    }
+
+    struct itimerspec its = {};
+    if (next >= 0) {
+        long long at = t0 + next;
+        its.it_value.tv_sec = at / 1000000000LL;
+        its.it_value.tv_nsec = at % 1000000000LL;
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+// The input as the recording read it at the same replay time: the last
+// read made by then, or the first one before any
+int ReplayFpgaDevice::readInput(unsigned int periph, uint32_t* value) {
+    const std::vector<FpgaTraceRecord>& r = reads[periph];
+    unsigned long long elapsed = monotonic_ns() - t0;
+    size_t& pos = read_pos[periph];
+
+    while (pos + 1 < r.size() && r[pos + 1].ns <= elapsed) {
+        pos++;
+    }
+
+    // Like the driver's RD_INPUTS, reading consumes the notification
+    uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {
+        // Not expired, nothing to consume
+    }
+    armInputTimer();
+
+    *value = r[pos].value;
+    if (r[pos].err) {
+        errno = r[pos].err;
+        return -1;
+    }
+    return 0;
+}
+
+int ReplayFpgaDevice::readReg(unsigned int periph, uint32_t* value) {
+    if (periph >= PERIPH_COUNT || reads[periph].empty()) {
+        // Never read while recording, like the mock
+        *value = 0;
+        return 0;
+    }
+    if (is_input(periph)) {
+        return readInput(periph, value);
+    }
+
+    size_t n = reads[periph].size();
+    const FpgaTraceRecord& rec = reads[periph][read_pos[periph] < n ? read_pos[periph]++ : n - 1];
+    *value = rec.value;
+    if (rec.err) {
+        errno = rec.err;
+        return -1;
+    }
+    return 0;
+}
+
+// Compare an animation with the next recorded one: frame count, loop flag
+// and every frame field
+int ReplayFpgaDevice::playAnimation(const struct ihs_frame* frames, unsigned int count, bool loop) {
+    if (anim_pos >= anims.size()) {
+        if (mismatched++ < 10) {
+            printf("Replay: animation of %u frames played past the end of the trace\n", count);
+        }
+        return 0;
+    }
+
+    const Animation& anim = anims[anim_pos++];
+    std::vector<uint32_t> fields = frame_fields(frames, count);
+    if (anim.rec.value == count && anim.rec.periph == loop && anim.fields == fields) {
+        matched++;
+    } else if (mismatched++ < 10) {
+        size_t i = 0;
+        while (i < fields.size() && i < anim.fields.size() && fields[i] == anim.fields[i]) {
+            i++;
+        }
+        if (anim.rec.value != count || anim.rec.periph != loop || i == fields.size()) {
+            printf("Replay: animation #%zu: %u frames%s played, trace has %u%s at %.3f ms\n",
+                   anim_pos, count, loop ? " looped" : "",
+                   anim.rec.value, anim.rec.periph ? " looped" : "", anim.rec.ns / 1e6);
+        } else {
+            printf("Replay: animation #%zu frame %zu %s: 0x%08X played, trace has 0x%08X at %.3f ms\n",
+                   anim_pos, i / FPGA_TRACE_FRAME_FIELDS,
+                   frame_field_names[i % FPGA_TRACE_FRAME_FIELDS],
+                   fields[i], i < anim.fields.size() ? anim.fields[i] : 0, anim.rec.ns / 1e6);
+        }
+    }
+    if (anim.rec.err) {
+        errno = anim.rec.err;
+        return -1;
+    }
+    return 0;
+}
+
+FpgaDevice* fpga_open_from_env() {
+    const char* spec = getenv("PONG_FPGA");
+    FpgaDevice* dev;
+
+    if (spec && strcmp(spec, "null") == 0) {
+        dev = new MockFpgaDevice();
+    } else if (spec && strncmp(spec, "replay:", 7) == 0) {
+        ReplayFpgaDevice* replay = new ReplayFpgaDevice();
+        if (replay->load(spec + 7) < 0) {
+            int err = errno;
+            delete replay;
+            errno = err;
+            return NULL;
+        }
+        dev = replay;
+    } else {
+        dev = fpga_open_driver(spec ? spec : "/dev/de2i-150");
+        if (!dev) return NULL;
+    }
+
+    const char* record = getenv("PONG_FPGA_RECORD");
+    if (record) {
+        FILE* log = fopen(record, "wb");
+        if (!log) {
+            int err = errno;
+            delete dev;
+            errno = err;
+            return NULL;
+        }
+        printf("Recording FPGA accesses to %s\n", record);
+        dev = new RecordingFpgaDevice(dev, log);
+    }
+
+    return dev;
+}
@@ -4,113 +4,385 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
 #include <errno.h>
 #include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
 
 #include "ioctl_cmds.h"
+#include "fpga_device.h"
 #include "display.h"
+#include "latency.h"
 #include "pong.h"
 
+uint32_t score_to_display(int score);
+static void stop_led_animation(GameData* game);
+
+// The typed device call behind an output register
+static int write_output(FpgaDevice* fpga, unsigned int periph, uint32_t value) {
+    switch (periph) {
+        case PERIPH_RED_LEDS:   return fpga->setRedLeds(value);
+        case PERIPH_GREEN_LEDS: return fpga->setGreenLeds(value);
+        case PERIPH_L_DISPLAY:  return fpga->setHex(HEX_LEFT, value);
+        case PERIPH_R_DISPLAY:  return fpga->setHex(HEX_RIGHT, value);
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+// Write an output register unless it already holds the value. Outputs are
+// recomputed every tick but only change on a score, state or LED step.
+static int commit_output(GameData* game, unsigned int periph, uint32_t value) {
+    if ((game->hw_out_valid & (1u << periph)) && game->hw_out[periph] == value) {
+        game->hw_writes_elided++;
+        return 0;
+    }
+    game->hw_writes++;
+    if (write_output(game->fpga, periph, value) == 0) {
+        game->hw_out[periph] = value;
+        game->hw_out_valid |= 1u << periph;
+        return 0;
+    }
+    // Unknown register contents, write it again next time
+    game->hw_out_valid &= ~(1u << periph);
+    return -1;
+}
+
+static void wake_hardware_thread(GameData* game) {
+    uint64_t one = 1;
+    if (write(game->hw_wake_fd, &one, sizeof(one)) < 0) {
+        // Counter saturated: the thread has a wakeup pending anyway
+    }
+}
+
+static uint32_t queue_command(GameData* game, uint16_t op, uint16_t periph, uint32_t value) {
+    if (!game->fpga) {
+        errno = ENODEV;
+        return 0;
+    }
+
+    HwCommand cmd;
+    cmd.seq = game->hw_cmd_seq + 1;
+    if (cmd.seq == 0) cmd.seq = 1;  // 0 means not queued
+    cmd.op = op;
+    cmd.periph = periph;
+    cmd.value = value;
+
+    if (!game->hw_cmds.push(cmd)) {
+        game->hw_cmd_dropped++;
+        errno = EAGAIN;
+        return 0;
+    }
+    game->hw_cmd_seq = cmd.seq;
+    return cmd.seq;
+}
+
+uint32_t hw_write(GameData* game, unsigned int periph, uint32_t value) {
+    if (periph >= PERIPH_COUNT) {
+        errno = EINVAL;
+        return 0;
+    }
+    return queue_command(game, HW_CMD_WRITE, periph, value);
+}
+
+int hw_wait(GameData* game, uint32_t seq) {
+    if (seq == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    // Commands are otherwise picked up on the next tick
+    wake_hardware_thread(game);
+
+    pthread_mutex_lock(&game->hw_done_lock);
+    while ((int32_t)(game->hw_cmd_done.load(std::memory_order_acquire) - seq) < 0) {
+        pthread_cond_wait(&game->hw_done_cond, &game->hw_done_lock);
+    }
+    pthread_mutex_unlock(&game->hw_done_lock);
+
+    // Sequence numbers wrap, compare them by difference
+    uint32_t failed = game->hw_cmd_failed.load(std::memory_order_acquire);
+    int ret = 0;
+    if ((int32_t)(failed - game->hw_cmd_waited) > 0 && (int32_t)(failed - seq) <= 0) {
+        errno = game->hw_cmd_errno.load(std::memory_order_relaxed);
+        ret = -1;
+    }
+    game->hw_cmd_waited = seq;
+    return ret;
+}
+
+// Hardware thread: note a failed command for hw_wait()
+static void command_failed(GameData* game, uint32_t seq) {
+    game->hw_cmd_errno.store(errno, std::memory_order_relaxed);
+    game->hw_cmd_failed.store(seq, std::memory_order_release);
+}
+
+// Hardware thread: issue the writes collected by run_commands()
+static void flush_writes(GameData* game, const HwCommand* pending, uint32_t* mask) {
+    for (unsigned int periph = 0; periph < PERIPH_COUNT; periph++) {
+        if ((*mask & (1u << periph)) && commit_output(game, periph, pending[periph].value) < 0) {
+            command_failed(game, pending[periph].seq);
+        }
+    }
+    *mask = 0;
+}
+
+// Hardware thread: write test patterns to every output and read them back.
+// Output PIOs read back their data register, so no one has to watch the board.
+static int run_self_test(GameData* game) {
+    static const uint32_t patterns[] = { 0xAAAAAAAA, 0x55555555, 0xFFFFFFFF, 0x00000000 };
+    static const struct {
+        unsigned int periph;
+        uint32_t mask;
+        const char* name;
+    } outputs[] = {
+        { PERIPH_RED_LEDS,   fpga::ledr::mask,     "red LEDs" },
+        { PERIPH_GREEN_LEDS, fpga::ledg::mask,     "green LEDs" },
+        { PERIPH_L_DISPLAY,  fpga::hexport1::mask, "left display" },
+        { PERIPH_R_DISPLAY,  fpga::hexport::mask,  "right display" },
+    };
+    const unsigned int n_outputs = sizeof(outputs) / sizeof(outputs[0]);
+    int failures = 0;
+
+    for (uint32_t pattern : patterns) {
+        for (unsigned int i = 0; i < n_outputs; i++) {
+            if (write_output(game->fpga, outputs[i].periph, pattern) < 0) {
+                printf("❌ %s: write failed: %s\n", outputs[i].name, strerror(errno));
+                failures++;
+            }
+        }
+
+        // Posted writes must reach the board before they can be read back
+        game->fpga->sync();
+
+        for (unsigned int i = 0; i < n_outputs; i++) {
+            uint32_t value;
+            if (game->fpga->readReg(outputs[i].periph, &value) < 0) {
+                printf("❌ %s: read failed: %s\n", outputs[i].name, strerror(errno));
+                failures++;
+            } else if ((value & outputs[i].mask) != (pattern & outputs[i].mask)) {
+                printf("❌ %s: wrote 0x%08X, read 0x%08X\n", outputs[i].name, pattern, value);
+                failures++;
+            }
+        }
+    }
+
+    // The test went around the output shadow
+    game->hw_out_valid = 0;
+
+    printf("Self-test: %d of %u register checks failed\n", failures,
+           (unsigned int)(sizeof(patterns) / sizeof(patterns[0])) * n_outputs * 2);
+    if (failures) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+// Hardware thread: run everything queued as one batch. Writes to the same
+// register collapse to the last one, and are flushed before a self-test.
+// Returns 1 once HW_CMD_QUIT was seen.
+static int run_commands(GameData* game) {
+    HwCommand pending[PERIPH_COUNT];
+    uint32_t mask = 0;
+    HwCommand cmd;
+    uint32_t last = 0;
+    int quit = 0;
+
+    while (game->hw_cmds.pop(&cmd)) {
+        last = cmd.seq;
+        switch (cmd.op) {
+            case HW_CMD_WRITE:
+                pending[cmd.periph] = cmd;
+                mask |= 1u << cmd.periph;
+                break;
+
+            case HW_CMD_SELFTEST:
+                flush_writes(game, pending, &mask);
+                if (run_self_test(game) < 0) {
+                    command_failed(game, cmd.seq);
+                }
+                break;
+
+            case HW_CMD_QUIT:
+                quit = 1;
+                break;
+        }
+    }
+    flush_writes(game, pending, &mask);
+
+    if (last) {
+        pthread_mutex_lock(&game->hw_done_lock);
+        game->hw_cmd_done.store(last, std::memory_order_release);
+        pthread_cond_broadcast(&game->hw_done_cond);
+        pthread_mutex_unlock(&game->hw_done_lock);
+    }
+    return quit;
+}
+
 // Initialize hardware connection
 int init_hardware(GameData* game) {
     printf("Initializing FPGA hardware....\n");
+    game->hw_anim = HW_ANIM_NONE;
     
-    // Try to open the PCI device file
-    game->fpga_fd = open("/dev/de2i-150", O_RDWR);
-    if (game->fpga_fd < 0) {
+    // The PCI device file unless PONG_FPGA picks another backend
+    game->fpga = fpga_open_from_env();
+    if (!game->fpga) {
         printf("Failed to open FPGA device: %s\n", strerror(errno));
         printf("Make sure driver is loaded and device file exists\n");
         return -1;
     }
     
-    printf("FPGA device opened successfully (fd=%d)\n", game->fpga_fd);
+    printf("FPGA backend: %s\n", game->fpga->name());
     
-    // Test initial communication with VISIBLE patterns
-    printf("=== TESTING HARDWARE WITH VISIBLE PATTERNS ===\n");
+    // Nothing shown yet, the first update_displays() queues both scores
+    game->hw_score_shown[0] = game->hw_score_shown[1] = -1;
+    game->hw_anim_seen = 0;
+    game->hw_anim_changes.store(0, std::memory_order_relaxed);
 
-    // Test red LEDs with a visible pattern
-    printf("Testing WR_RED_LEDS with visible pattern...\n");
-    if (ioctl(game->fpga_fd, WR_RED_LEDS) < 0) {
-        printf("❌ IOCTL WR_RED_LEDS failed: %s\n", strerror(errno));
-    } else {
-        printf("✓ IOCTL WR_RED_LEDS success\n");
-        uint32_t red_pattern = 0xAAAAAAAA; // Alternating pattern
-        ssize_t written = write(game->fpga_fd, &red_pattern, sizeof(red_pattern));
-        printf("✓ Red LEDs written: %ld bytes, pattern=0x%X\n", written, red_pattern);
-        printf(">> CHECK: Red LEDs should show alternating pattern!\n");
+    // From here on only the hardware thread touches the device
+    game->hw_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (game->hw_wake_fd < 0) {
+        printf("Failed to create hardware thread wakeup: %s\n", strerror(errno));
+        delete game->fpga;
+        game->fpga = NULL;
+        return -1;
     }
-
-    // Wait to see the effect
-    sleep(2);
-
-    // Test green LEDs
-    printf("Testing WR_GREEN_LEDS with visible pattern...\n");
-    if (ioctl(game->fpga_fd, WR_GREEN_LEDS) < 0) {
-        printf("❌ IOCTL WR_GREEN_LEDS failed: %s\n", strerror(errno));
-    } else {
-        printf("✓ IOCTL WR_GREEN_LEDS success\n");
-        uint32_t green_pattern = 0x55555555; // Different alternating pattern
-        ssize_t written = write(game->fpga_fd, &green_pattern, sizeof(green_pattern));
-        printf("✓ Green LEDs written: %ld bytes, pattern=0x%X\n", written, green_pattern);
-        printf(">> CHECK: Green LEDs should show different pattern!\n");
+    pthread_mutex_init(&game->hw_done_lock, NULL);
+    pthread_cond_init(&game->hw_done_cond, NULL);
+    game->hw_follow = false;
+    pthread_create(&game->hw_thread, NULL, hardware_thread, game);
+    
+    // Opt-in self-test: every output is written and read back, no waiting
+    // for someone to look at the board
+    const char* selftest = getenv("PONG_SELFTEST");
+    if (selftest && strcmp(selftest, "0") != 0) {
+        printf("=== HARDWARE SELF-TEST ===\n");
+        if (hw_wait(game, queue_command(game, HW_CMD_SELFTEST, 0, 0)) < 0) {
+            printf("❌ Hardware self-test failed: %s\n", strerror(errno));
+        } else {
+            printf("✓ Hardware self-test passed\n");
+        }
     }
 
-    sleep(2);
-
-    // Test 7-segment displays with number
-    printf("Testing displays with number 8...\n");
-    uint32_t display_8 = 0xFFFFFF80; // Number 8
-    if (ioctl(game->fpga_fd, WR_L_DISPLAY) >= 0) {
-        write(game->fpga_fd, &display_8, sizeof(display_8));
-        printf("✓ Left display should show '8'\n");
-    }
-    if (ioctl(game->fpga_fd, WR_R_DISPLAY) >= 0) {
-        write(game->fpga_fd, &display_8, sizeof(display_8));
-        printf("✓ Right display should show '8'\n");
-    }
+    // Outputs show the game from now on
+    game->hw_follow.store(true, std::memory_order_release);
 
-    printf("=== HARDWARE TEST COMPLETE ===\n");
-    printf("If you see the patterns/numbers, hardware is working!\n");
     printf("Hardware initialization complete\n");
     return 0;
 }
 
 // Cleanup hardware resources
 void cleanup_hardware(GameData* game) {
-    if (game->fpga_fd >= 0) {
+    if (game->fpga) {
         printf("Cleaning up FPGA hardware...\n");
+
+        // The hardware thread blanks the board on its way out
+        while (!queue_command(game, HW_CMD_QUIT, 0, 0)) {
+            wake_hardware_thread(game);
+            usleep(1000);
+        }
+        wake_hardware_thread(game);
+        pthread_join(game->hw_thread, NULL);
+
+        unsigned long total = game->hw_writes + game->hw_writes_elided;
+        printf("FPGA output writes: %lu issued, %lu elided (%.1f%%)\n",
+               game->hw_writes, game->hw_writes_elided,
+               total ? 100.0 * game->hw_writes_elided / total : 0.0);
+        if (game->hw_cmd_dropped) {
+            printf("FPGA commands dropped, queue full: %lu\n", game->hw_cmd_dropped);
+        }
         
-        // Turn off all LEDs and displays before closing
-        uint32_t zero = 0;
-        uint32_t display_off = 0xFFFFFFFF;
-        
-        ioctl(game->fpga_fd, WR_RED_LEDS);
-        write(game->fpga_fd, &zero, sizeof(zero));
-        
-        ioctl(game->fpga_fd, WR_GREEN_LEDS);
-        write(game->fpga_fd, &zero, sizeof(zero));
-        
-        ioctl(game->fpga_fd, WR_L_DISPLAY);
-        write(game->fpga_fd, &display_off, sizeof(display_off));
-        
-        ioctl(game->fpga_fd, WR_R_DISPLAY);
-        write(game->fpga_fd, &display_off, sizeof(display_off));
-        
-        close(game->fpga_fd);
+        close(game->hw_wake_fd);
+        pthread_cond_destroy(&game->hw_done_cond);
+        pthread_mutex_destroy(&game->hw_done_lock);
+        delete game->fpga;
+        game->fpga = NULL;
         printf("FPGA device closed\n");
     }
 }
 
+// Upload the LED pattern of a non-playing state for the driver to play
+static int start_led_animation(GameData* game, const HwSnapshot* snap) {
+    uint32_t hex_l = score_to_display(snap->score1);
+    uint32_t hex_r = score_to_display(snap->score2);
+    uint32_t winner = 0xFFFFFFFF;
+    struct ihs_frame frames[2];
+    unsigned int count;
+    bool loop = false;
+
+    switch (snap->state) {
+        case GAME_MENU:
+            // Blinking pattern for menu, alternating LEDs twice a second
+            frames[0] = {500000, 0, 0x55555555, hex_l, hex_r};
+            frames[1] = {500000, 0, 0xAAAAAAAA, hex_l, hex_r};
+            count = 2;
+            loop = true;
+            break;
+
+        case GAME_PAUSED:
+            // All red for pause
+            frames[0] = {ANIM_MIN_DELAY_US, winner, 0, hex_l, hex_r};
+            count = 1;
+            break;
+
+        case GAME_OVER:
+            // Victory pattern - winner's color
+            if (snap->winner == 1) {
+                frames[0] = {ANIM_MIN_DELAY_US, 0, winner, hex_l, hex_r};
+            } else {
+                frames[0] = {ANIM_MIN_DELAY_US, winner, 0, hex_l, hex_r};
+            }
+            count = 1;
+            break;
+
+        default:
+            return -1;
+    }
+
+    // The driver owns the outputs while it plays
+    game->hw_out_valid = 0;
+    if (game->fpga->playAnimation(frames, count, loop) < 0) return -1;
+
+    // Its frames rewrote the displays, have the game thread queue the scores again
+    game->hw_anim_changes.fetch_add(1, std::memory_order_release);
+    return 0;
+}
+
+static void stop_led_animation(GameData* game) {
+    if (game->hw_anim < 0) return;
+
+    game->fpga->playAnimation(NULL, 0, false);
+    game->hw_anim = HW_ANIM_NONE;
+    // Whatever frame it stopped on is left on the board
+    game->hw_out_valid = 0;
+    game->hw_anim_changes.fetch_add(1, std::memory_order_release);
+}
+
 // Update LEDs based on game state
-void update_leds(GameData* game) {
-    if (game->fpga_fd < 0) return;
+void update_leds(GameData* game, const HwSnapshot* snap) {
+    if (!game->fpga) return;
+
+    // Outside of play the pattern only depends on the state: hand it to the
+    // driver once instead of rewriting it every tick
+    if (snap->state == GAME_PLAYING) {
+        stop_led_animation(game);
+    } else if (game->hw_anim == (int)snap->state) {
+        return;
+    } else if (game->hw_anim != HW_ANIM_UNSUPPORTED) {
+        if (start_led_animation(game, snap) == 0) {
+            game->hw_anim = snap->state;
+            return;
+        }
+        // Older driver or emulator: fall back to writing every tick
+        if (errno == ENOTTY) game->hw_anim = HW_ANIM_UNSUPPORTED;
+    }
     
     uint32_t red_pattern = 0;
     uint32_t green_pattern = 0;
     
-    switch (game->state) {
+    switch (snap->state) {
         case GAME_MENU:
             // Blinking pattern for menu
             green_pattern = 0x55555555; // Alternating LEDs
@@ -120,8 +392,8 @@ void update_leds(GameData* game) {
             // Show ball position with LEDs
             // Red LEDs represent ball X position (left side)
             // Green LEDs represent ball Y position (relative)
-            red_pattern = (uint32_t)(game->ball.x / WINDOW_WIDTH * 32) & 0xFFFFFFFF;
-            green_pattern = (uint32_t)(game->ball.y / WINDOW_HEIGHT * 32) & 0xFFFFFFFF;
+            red_pattern = (uint32_t)(snap->ball_x / WINDOW_WIDTH * 32) & 0xFFFFFFFF;
+            green_pattern = (uint32_t)(snap->ball_y / WINDOW_HEIGHT * 32) & 0xFFFFFFFF;
             break;
             
         case GAME_PAUSED:
@@ -131,7 +403,7 @@ void update_leds(GameData* game) {
             
         case GAME_OVER:
             // Victory pattern - winner's color
-            if (game->winner == 1) {
+            if (snap->winner == 1) {
                 green_pattern = 0xFFFFFFFF; // Player 1 wins
             } else {
                 red_pattern = 0xFFFFFFFF;   // Player 2 wins
@@ -139,68 +411,58 @@ void update_leds(GameData* game) {
             break;
     }
     
-    // Write to hardware - CRITICAL: Always call ioctl() before write()
-    if (ioctl(game->fpga_fd, WR_RED_LEDS) >= 0) {
-        write(game->fpga_fd, &red_pattern, sizeof(red_pattern));
-    }
-    
-    if (ioctl(game->fpga_fd, WR_GREEN_LEDS) >= 0) {
-        write(game->fpga_fd, &green_pattern, sizeof(green_pattern));
-    }
+    // Write to hardware - only the registers that changed
+    commit_output(game, PERIPH_RED_LEDS, red_pattern);
+    commit_output(game, PERIPH_GREEN_LEDS, green_pattern);
 }
 
-// Convert score to 7-segment display pattern
+// Convert score to 7-segment display pattern: all four digits, from the
+// table the compiler built, "----" past 9999
 uint32_t score_to_display(int score) {
-    uint32_t patterns[] = {
-        HEX_0, HEX_1, HEX_2, HEX_3, HEX_4,
-        HEX_5, HEX_6, HEX_7, HEX_8, HEX_9
-    };
-    
-    if (score >= 0 && score <= 9) {
-        return patterns[score];
-    }
-    
-    // For scores > 9, show last digit
-    return patterns[score % 10];
+    return seg7::decimal(score);
 }
 
-// Update 7-segment displays with scores
+// Game thread: update 7-segment displays with scores. A score change is
+// queued to the hardware thread; one that doesn't fit is queued next frame.
 void update_displays(GameData* game) {
-    if (game->fpga_fd < 0) return;
+    if (!game->fpga) return;
     
-    // Left display shows Player 1 score
-    uint32_t left_pattern = score_to_display(game->player1.score);
-    
-    // Right display shows Player 2 score  
-    uint32_t right_pattern = score_to_display(game->player2.score);
+    // An LED animation started or stopped since the scores were queued put
+    // the digits of its frames on the displays: queue both scores again, so
+    // they are written after it
+    uint32_t anim_changes = game->hw_anim_changes.load(std::memory_order_acquire);
+    if (anim_changes != game->hw_anim_seen) {
+        game->hw_anim_seen = anim_changes;
+        game->hw_score_shown[0] = game->hw_score_shown[1] = -1;
+    game->hw_anim_seen = 0;
+    game->hw_anim_changes.store(0, std::memory_order_relaxed);
+    }
     
-    // Write to hardware - CRITICAL: Always call ioctl() before write()
-    if (ioctl(game->fpga_fd, WR_L_DISPLAY) >= 0) {
-        write(game->fpga_fd, &left_pattern, sizeof(left_pattern));
+    // Left display shows Player 1 score
+    if (game->player1.score != game->hw_score_shown[0] &&
+        hw_set_hex(game, HEX_LEFT, score_to_display(game->player1.score))) {
+        game->hw_score_shown[0] = game->player1.score;
     }
     
-    if (ioctl(game->fpga_fd, WR_R_DISPLAY) >= 0) {
-        write(game->fpga_fd, &right_pattern, sizeof(right_pattern));
+    // Right display shows Player 2 score
+    if (game->player2.score != game->hw_score_shown[1] &&
+        hw_set_hex(game, HEX_RIGHT, score_to_display(game->player2.score))) {
+        game->hw_score_shown[1] = game->player2.score;
     }
 }
 
 // Read switches and buttons (for future features)
 void read_hardware_inputs(GameData* game) {
-    if (game->fpga_fd < 0) return;
-    
-    uint32_t data;
+    if (!game->fpga) return;
     
-    // Read switches
-    if (ioctl(game->fpga_fd, RD_SWITCHES) >= 0) {
-        if (read(game->fpga_fd, &data, sizeof(data)) > 0) {
-            game->switches = data;
-        }
-    }
+    uint32_t switches, buttons;
     
-    // Read push buttons
-    if (ioctl(game->fpga_fd, RD_PBUTTONS) >= 0) {
-        if (read(game->fpga_fd, &data, sizeof(data)) > 0) {
-            game->buttons = data;
+    // Both inputs in one sample; with the driver this also re-arms the
+    // POLLIN notification the hardware thread waits on
+    if (game->fpga->readInputs(&switches, &buttons) == 0) {
+        uint64_t in = (uint64_t)switches << 32 | buttons;
+        if (game->hw_inputs.exchange(in, std::memory_order_relaxed) != in) {
+            game->hw_inputs_ns.store(latency_now_ns(), std::memory_order_release);
         }
     }
     
@@ -211,28 +473,140 @@ void read_hardware_inputs(GameData* game) {
     // - Button 1: Reset game
 }
 
-// Hardware monitoring thread
+// Game thread: copy what the outputs depend on and hand it over. The
+// caller owns the game fields, so no lock is needed to read them.
+void publish_snapshot(GameData* game) {
+    SnapshotBuffer* sb = &game->hw_snap;
+    HwSnapshot* snap = &sb->buf[sb->back];
+
+    snap->state = game->state;
+    snap->ball_x = game->ball.x;
+    snap->ball_y = game->ball.y;
+    snap->score1 = game->player1.score;
+    snap->score2 = game->player2.score;
+    snap->winner = game->winner;
+    snap->frame = game->frame;
+    snap->state_key_ns = game->state_key_ns;
+    snap->publish_ns = latency_now_ns();
+
+    unsigned prev = sb->middle.exchange(sb->back | SNAP_FRESH, std::memory_order_acq_rel);
+    sb->back = prev & ~SNAP_FRESH;
+}
+
+// Hardware thread: the newest published snapshot, stays valid until the
+// next call
+static const HwSnapshot* latest_snapshot(GameData* game) {
+    SnapshotBuffer* sb = &game->hw_snap;
+
+    if (sb->middle.load(std::memory_order_relaxed) & SNAP_FRESH) {
+        unsigned prev = sb->middle.exchange(sb->front, std::memory_order_acq_rel);
+        sb->front = prev & ~SNAP_FRESH;
+    }
+    return &sb->buf[sb->front];
+}
+
+// Output update period: 30Hz to avoid overwhelming the hardware
+#define HW_TICK_NS 33333333L
+
+// Milliseconds left until a monotonic deadline, rounded up, 0 if past
+static int ms_until(const struct timespec* deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long ns = (deadline->tv_sec - now.tv_sec) * 1000000000LL +
+                   (deadline->tv_nsec - now.tv_nsec);
+    return (ns <= 0) ? 0 : (int)((ns + 999999) / 1000000);
+}
+
+// Hardware thread: the only one doing FPGA I/O. It runs queued commands
+// (the score writes among them), reads the inputs and keeps the LEDs in
+// line with the game snapshots.
 void* hardware_thread(void* arg) {
     GameData* game = (GameData*)arg;
+    struct timespec next_tick;
+    int quit = 0;
     
     printf("Hardware thread started\n");
+    clock_gettime(CLOCK_MONOTONIC, &next_tick);
     
-    while (game->running) {
-        pthread_mutex_lock(&game->mutex);
+    while (!quit) {
+        // Sleep until the next tick; the driver's input sampler wakes us
+        // early when switches or buttons change (poll ignores fd < 0), and
+        // hw_wait() when a command is waited for
+        struct pollfd pfd[2] = {
+            { game->fpga->inputFd(), POLLIN, 0 },
+            { game->hw_wake_fd, POLLIN, 0 }
+        };
+        int ready = poll(pfd, 2, ms_until(&next_tick));
+        int tick = (ms_until(&next_tick) == 0);
+        
+        if (ready > 0 && (pfd[1].revents & POLLIN)) {
+            uint64_t wakeups;
+            if (read(game->hw_wake_fd, &wakeups, sizeof(wakeups)) < 0) {
+                // Already drained, nothing to do
+            }
+        }
         
-        // Read inputs
-        read_hardware_inputs(game);
+        // Counted from here, so the queued score writes are timed as well
+        unsigned long writes = game->hw_writes;
+        int anim = game->hw_anim;
+        
+        // No lock held: the game thread never waits on hardware I/O
+        quit = run_commands(game);
+        
+        // Read inputs on change, and on every tick in case the sampler is off
+        if (tick || (ready > 0 && (pfd[0].revents & POLLIN))) {
+            read_hardware_inputs(game);
+        }
         
         // Update outputs
-        update_leds(game);
-        update_displays(game);
+        const HwSnapshot* snap = NULL;
+        if (tick && !quit && game->hw_follow.load(std::memory_order_acquire)) {
+            snap = latest_snapshot(game);
+            update_leds(game, snap);
+        }
         
-        pthread_mutex_unlock(&game->mutex);
+        // Latency of the frames and key presses that changed the board. A
+        // score is queued right after the snapshot of its frame, so that
+        // one (or a newer one) is the latest here.
+        if (game->hw_writes != writes || game->hw_anim != anim) {
+            if (!snap) snap = latest_snapshot(game);
+            long long now = latency_now_ns();
+            if (snap->frame != game->hw_frame_shown) {
+                latency_record(LAT_FRAME_TO_BOARD, now - snap->publish_ns);
+                game->hw_frame_shown = snap->frame;
+            }
+            if (snap->state_key_ns && snap->state_key_ns != game->hw_key_shown) {
+                latency_record(LAT_KEY_TO_BOARD, now - snap->state_key_ns);
+                game->hw_key_shown = snap->state_key_ns;
+            }
+        }
         
-        // Update at 30Hz to avoid overwhelming the hardware
-        usleep(33333); // ~30 FPS
+        if (tick) {
+            next_tick.tv_nsec += HW_TICK_NS;
+            if (next_tick.tv_nsec >= 1000000000L) {
+                next_tick.tv_sec++;
+                next_tick.tv_nsec -= 1000000000L;
+            }
+            // Don't try to catch up on missed ticks
+            if (ms_until(&next_tick) == 0) {
+                clock_gettime(CLOCK_MONOTONIC, &next_tick);
+            }
+        }
     }
     
+    // Turn off all LEDs and displays before closing
+    uint32_t zero = 0;
+    uint32_t display_off = 0xFFFFFFFF;
+    
+    stop_led_animation(game);
+    commit_output(game, PERIPH_RED_LEDS, zero);
+    commit_output(game, PERIPH_GREEN_LEDS, zero);
+    commit_output(game, PERIPH_L_DISPLAY, display_off);
+    commit_output(game, PERIPH_R_DISPLAY, display_off);
+
+    // Wait for the queued writes to reach the board
+    game->fpga->sync();
+    
     printf("Hardware thread finished\n");
     return NULL;
 }
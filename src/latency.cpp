@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <atomic>
+
+#include "latency.h"
+
+// Log-linear buckets: values below 16 ns have their own bucket, above that
+// each power of two is split in 16 steps
+#define LAT_SUB_BITS 4
+#define LAT_SUB      (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS  ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+// One writer per histogram, relaxed atomics so a dump can run concurrently
+typedef struct {
+    std::atomic<unsigned long> count[LAT_BUCKETS];
+    std::atomic<unsigned long> total;
+    std::atomic<long long> max;
+} Histogram;
+
+static Histogram histograms[LAT_COUNT];
+
+static const char* const path_names[LAT_COUNT] = {
+    "key to screen",
+    "key to board",
+    "frame to board",
+    "button to game",
+    "render",
+};
+
+static volatile sig_atomic_t dump_requested;
+
+long long latency_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static unsigned int bucket_of(uint64_t ns) {
+    if (ns < LAT_SUB) {
+        return (unsigned int)ns;
+    }
+    unsigned int msb = 63 - __builtin_clzll(ns);
+    unsigned int shift = msb - LAT_SUB_BITS;
+    return (msb - LAT_SUB_BITS + 1) * LAT_SUB + (unsigned int)((ns >> shift) & (LAT_SUB - 1));
+}
+
+// Smallest value falling in a bucket
+static uint64_t bucket_floor(unsigned int idx) {
+    if (idx < LAT_SUB) {
+        return idx;
+    }
+    unsigned int msb = idx / LAT_SUB + LAT_SUB_BITS - 1;
+    uint64_t sub = idx % LAT_SUB;
+    return (LAT_SUB + sub) << (msb - LAT_SUB_BITS);
+}
+
+void latency_record(int path, long long ns) {
+    if (path < 0 || path >= LAT_COUNT) return;
+    if (ns < 0) ns = 0;
+
+    Histogram* h = &histograms[path];
+    unsigned int idx = bucket_of((uint64_t)ns);
+
+    // Single writer: plain read-modify-write, atomic only for the reader
+    h->count[idx].store(h->count[idx].load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+    h->total.store(h->total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (ns > h->max.load(std::memory_order_relaxed)) {
+        h->max.store(ns, std::memory_order_relaxed);
+    }
+}
+
+// Value below which a fraction q of the samples fall
+static double percentile_ms(Histogram* h, unsigned long total, double q) {
+    unsigned long rank = (unsigned long)(q * (total - 1));
+    unsigned long seen = 0;
+
+    for (unsigned int i = 0; i < LAT_BUCKETS; i++) {
+        seen += h->count[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            return bucket_floor(i) / 1e6;
+        }
+    }
+    return h->max.load(std::memory_order_relaxed) / 1e6;
+}
+
+void latency_dump(FILE* out) {
+    fprintf(out, "%-16s %8s %9s %9s %9s\n", "latency (ms)", "count", "p50", "p99", "max");
+    for (int path = 0; path < LAT_COUNT; path++) {
+        Histogram* h = &histograms[path];
+        unsigned long total = h->total.load(std::memory_order_relaxed);
+
+        if (total == 0) {
+            fprintf(out, "%-16s %8lu %9s %9s %9s\n", path_names[path], total, "-", "-", "-");
+            continue;
+        }
+        fprintf(out, "%-16s %8lu %9.3f %9.3f %9.3f\n", path_names[path], total,
+                percentile_ms(h, total, 0.50), percentile_ms(h, total, 0.99),
+                h->max.load(std::memory_order_relaxed) / 1e6);
+    }
+    fflush(out);
+}
+
+static void on_dump_signal(int signo) {
+    dump_requested = 1;
+}
+
+void latency_dump_on_signal(int signo) {
+    struct sigaction sa = {};
+    sa.sa_handler = on_dump_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(signo, &sa, NULL);
+}
+
+bool latency_dump_requested() {
+    if (!dump_requested) return false;
+    dump_requested = 0;
+    return true;
+}
@@ -8,15 +8,41 @@
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <pthread.h>
+#include <time.h>
+#include <signal.h>
 #include <SDL2/SDL.h>
 
 #include "ioctl_cmds.h"
 #include "display.h"
+#include "latency.h"
 #include "pong.h"
 
 // Global game data
 GameData game_data;
 
+// Monotonic clock in milliseconds, for the startup phase timing
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Hardware bring-up, run next to the SDL initialization
+typedef struct {
+    GameData* game;
+    int result;
+    double ms;
+} HardwareInit;
+
+static void* hardware_init_thread(void* arg) {
+    HardwareInit* init = (HardwareInit*)arg;
+    double start = now_ms();
+    
+    init->result = init_hardware(init->game);
+    init->ms = now_ms() - start;
+    return NULL;
+}
+
 // Initialize SDL and create window
 int init_graphics(SDL_Window** window, SDL_Renderer** renderer) {
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
@@ -121,6 +147,14 @@ void update_game(GameData* game) {
 // Handle keyboard input
 void handle_input(GameData* game, const Uint8* keystate) {
     pthread_mutex_lock(&game->mutex);
+    GameState prev_state = game->state;
+    
+    // How long a new switch/button reading took to get here
+    long long hw_stamp = game->hw_inputs_ns.load(std::memory_order_acquire);
+    if (hw_stamp != game->hw_inputs_seen) {
+        latency_record(LAT_BUTTON_TO_GAME, latency_now_ns() - hw_stamp);
+        game->hw_inputs_seen = hw_stamp;
+    }
     
     // Player 1 controls (W/S)
     if (keystate[SDL_SCANCODE_W] && game->player1.y > 0) {
@@ -153,6 +187,11 @@ void handle_input(GameData* game, const Uint8* keystate) {
         init_game(game);
     }
     
+    // Remember which key press changed the state, to time it on the board
+    if (game->state != prev_state && game->input_ns) {
+        game->state_key_ns = game->input_ns;
+    }
+    
     pthread_mutex_unlock(&game->mutex);
 }
 
@@ -192,35 +231,61 @@ int main(int argc, char** argv) {
     SDL_Window* window = NULL;
     SDL_Renderer* renderer = NULL;
     SDL_Event event;
-    pthread_t hardware_thread_id;
+    double start = now_ms();
+    int first_frame = 1;
     
     printf("FPGA Pong Game Starting...\n");
     
     // Initialize game
     init_game(&game_data);
     
-    // Initialize hardware
-    if (init_hardware(&game_data) < 0) {
+    // Hardware snapshots: one to fill, one to hand over, one being read
+    game_data.hw_snap.back = 0;
+    game_data.hw_snap.middle = 1;
+    game_data.hw_snap.front = 2;
+    publish_snapshot(&game_data);
+    
+    // Latency histograms are printed on exit, or on kill -USR1 <pid>
+    latency_dump_on_signal(SIGUSR1);
+    
+    // Initialize hardware in the background, this starts the hardware thread
+    HardwareInit hw_init = { &game_data, -1, 0.0 };
+    pthread_t hw_init_id;
+    pthread_create(&hw_init_id, NULL, hardware_init_thread, &hw_init);
+    
+    // Initialize graphics meanwhile, SDL wants the main thread
+    double gfx_start = now_ms();
+    int gfx_result = init_graphics(&window, &renderer);
+    double gfx_ms = now_ms() - gfx_start;
+    
+    pthread_join(hw_init_id, NULL);
+    if (hw_init.result < 0) {
         printf("Warning: Hardware initialization failed, continuing without FPGA features\n");
     }
-    
-    // Initialize graphics
-    if (init_graphics(&window, &renderer) < 0) {
+    if (gfx_result < 0) {
+        cleanup_hardware(&game_data);
         return -1;
     }
     
-    // Start hardware thread
-    pthread_create(&hardware_thread_id, NULL, hardware_thread, &game_data);
-    
+    printf("Startup: hardware %.1f ms, graphics %.1f ms, ready after %.1f ms\n",
+           hw_init.ms, gfx_ms, now_ms() - start);
     printf("Game initialized. Press SPACE to start, W/S and UP/DOWN to control paddles\n");
     
     // Main game loop
     while (game_data.running) {
+        game_data.frame++;
+        game_data.input_ns = 0;
+        
         // Handle events
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 game_data.running = 0;
             }
+            // Stamp key presses with their SDL time, not when we got to them
+            if (event.type == SDL_KEYDOWN && !event.key.repeat && !game_data.input_ns) {
+                game_data.input_ns = latency_now_ns() -
+                    (long long)(Uint32)(SDL_GetTicks() - event.key.timestamp) * 1000000LL;
+            }
         }
         
         // Handle continuous keyboard input
@@ -229,17 +294,36 @@ int main(int argc, char** argv) {
         
         // Update game logic
         update_game(&game_data);
+        long long sim_done = latency_now_ns();
+        
+        // Hand the frame to the hardware thread, without waiting for it
+        publish_snapshot(&game_data);
+        update_displays(&game_data);
         
         // Render
         render_game(renderer, &game_data);
         
+        long long presented = latency_now_ns();
+        latency_record(LAT_RENDER, presented - sim_done);
+        if (game_data.input_ns) {
+            latency_record(LAT_KEY_TO_SCREEN, presented - game_data.input_ns);
+        }
+        if (latency_dump_requested()) {
+            latency_dump(stdout);
+        }
+        
+        if (first_frame) {
+            printf("Startup: first frame after %.1f ms\n", now_ms() - start);
+            first_frame = 0;
+        }
+        
         // Control frame rate
         SDL_Delay(16); // ~60 FPS
     }
     
     // Cleanup
-    pthread_join(hardware_thread_id, NULL);
     cleanup_hardware(&game_data);
+    latency_dump(stdout);
     
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);